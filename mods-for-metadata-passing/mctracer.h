@@ -72,7 +72,9 @@ typedef
       VG_USERREQ__TRACING,
       VG_USERREQ__SIMPLESIM_DEFINE_DATA,
       VG_USERREQ__SIMPLESIM_CHANGE_SECTION,
-      VG_USERREQ__SIMPLESIM_CONFIGURE
+      VG_USERREQ__SIMPLESIM_CONFIGURE,
+      VG_USERREQ__SIMPLESIM_PUSH_SECTION,
+      VG_USERREQ__SIMPLESIM_POP_SECTION
    } Vg_McTracerClientRequest;
 
 /* Print a string into the trace, prefixed by "P  " */
@@ -123,7 +125,8 @@ typedef
                             description, start, length, 0, 0);          \
    }
 
-/* Change section in SimpleSim cache simulator to section #id*/
+/* Change section in SimpleSim cache simulator to section #id.
+   Ids from 0x40000000 up are reserved for function windows (--trace-fn) */
 #define SIMPLESIM_CHANGE_SECTION(id,description)     \
    {unsigned int _qzz_res;                                              \
     VALGRIND_DO_CLIENT_REQUEST(_qzz_res, 0,                             \
@@ -131,6 +134,24 @@ typedef
                             id, description, 0, 0, 0);               \
    }
 
+/* Enter section #id in SimpleSim cache simulator, nested into the
+   current one. Misses are attributed inclusively to all sections
+   entered, and exclusively to the innermost one */
+#define SIMPLESIM_PUSH_SECTION(id,description)     \
+   {unsigned int _qzz_res;                                              \
+    VALGRIND_DO_CLIENT_REQUEST(_qzz_res, 0,                             \
+                            VG_USERREQ__SIMPLESIM_PUSH_SECTION,         \
+                            id, description, 0, 0, 0);               \
+   }
+
+/* Leave section #id entered by SIMPLESIM_PUSH_SECTION */
+#define SIMPLESIM_POP_SECTION(id)     \
+   {unsigned int _qzz_res;                                              \
+    VALGRIND_DO_CLIENT_REQUEST(_qzz_res, 0,                             \
+                            VG_USERREQ__SIMPLESIM_POP_SECTION,          \
+                            id, 0, 0, 0, 0);                         \
+   }
+
 /* Init the SimpleSim cache simulator (cachesize) */
 #define SIMPLESIM_CONFIGURE(setting, value)         \
    {unsigned int _qzz_res;                                              \
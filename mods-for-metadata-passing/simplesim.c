@@ -8,6 +8,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "shmlib/shm_consumer.h"
 
@@ -16,6 +18,7 @@ typedef unsigned long long Addr;
 
 // type Addr is used in events definitions
 #include "tr_shmevents.h"
+#include "tr_decode.h"
 
 /* ----------------------------------------------------------------*/
 
@@ -31,8 +34,10 @@ typedef unsigned long long Addr;
 int cachelines = 8192;
 int setsize = 16;
 
-// derived parameter
-#define SETS (cachelines / setsize)
+// derived parameters, updated by cache_clear()
+int cache_sets = 8192 / 16;
+int set_bits = 9;    // log2(cache_sets), -1 if not a power of two
+#define SETS cache_sets
 
 //Define true and false
 #define TRUE 1
@@ -51,6 +56,18 @@ typedef struct _section{
 	int id;
 	unsigned int misses;
 	char description[64];
+	unsigned long long mem_read;     // bytes filled from memory
+	unsigned long long mem_written;  // bytes written back to memory
+	unsigned int miss_compulsory, miss_capacity, miss_conflict;
+	int bit;             // in section bitmap of cache lines
+	int index;           // into section_stats
+	// nesting via push/pop, see section stack below
+	struct _section* parent;  // enclosing section on first push
+	int on_stack;             // times on section stack
+	unsigned int incl_start, excl_start;  // global misses when entered
+	unsigned long long misses_incl, misses_excl;
+	int cat_class;       // way partitioning class, -1 if not assigned
+	unsigned int vbuf_hits;   // misses served by victim/miss buffer
 } Section;
 
 typedef struct _sectionnode{
@@ -64,6 +81,54 @@ typedef struct _sectionlist
 	SectionNode* last; 
 } SectionList;
 
+/* Cache lines store the sections accessing them as bitmap. The last
+ * bit stands for all sections created beyond the bitmap size; these
+ * are kept in the exact (spilled) line metadata, see below. */
+#define SECTION_BITS 64
+#define SECTION_OVERFLOW (SECTION_BITS-1)
+Section* section_of_bit[SECTION_OVERFLOW];
+int section_bits_used = 0;
+
+/* access counters per section, updated on each access */
+typedef struct _sectionstat {
+	unsigned long long loads, stores, lmisses, smisses;
+	unsigned long long evictions;   // valid lines replaced, also by prefetches
+	double cycles, stall;           // timing model, see below
+} SectionStat;
+
+SectionStat* section_stats = NULL;
+int section_count = 0, section_stats_size = 0;
+
+/* report section counters at exit (setting "section_stats") */
+int section_report = FALSE;
+
+int cat_section_class(int id);
+
+// new section with all counters zero
+Section* createSection(int id, const char* description)
+{
+	Section* section=malloc(sizeof(Section));
+	memset(section, 0, sizeof(Section));
+	section->id=id;
+	section->cat_class=cat_section_class(id);
+	strncpy(section->description, description, 63);
+	if(section_bits_used < SECTION_OVERFLOW)
+	{
+		section->bit=section_bits_used++;
+		section_of_bit[section->bit]=section;
+	}
+	else
+		section->bit=SECTION_OVERFLOW;
+	if(section_count == section_stats_size)
+	{
+		section_stats_size = section_stats_size ? 2*section_stats_size : 64;
+		section_stats = realloc(section_stats, section_stats_size * sizeof(SectionStat));
+	}
+	section->index=section_count++;
+	memset(&section_stats[section->index], 0, sizeof(SectionStat));
+	return section;
+}
+
 SectionList* createSectionList(Section* section)
 {
 	SectionList* list=malloc(sizeof(SectionList));
@@ -130,10 +195,15 @@ void freeSectionList(SectionList* list, int keepSections)
 	}
 }
 
+struct _layout;
+
 typedef struct _data{
 	Addr start;
 	Addr end;
 	Section* section;
+	Addr pagesize;      // for TLB simulation
+	unsigned int* set_misses;  // per cache set, with set statistics
+	struct _layout* layout;    // what-if layout transform, or NULL
 } Data;
 
 typedef struct _datanode{
@@ -170,6 +240,7 @@ void freeDataList(DataList* list)
 	DataNode* tmp=NULL;
 	while(next!=NULL)
 	{
+		free(next->data->layout);
 		free(next->data);
 		tmp=next->next;
 		free(next);
@@ -177,12 +248,46 @@ void freeDataList(DataList* list)
 	}
 }
 
+/*
+ * Per-line utilization metadata is kept compact (32 bytes per line):
+ * a mask of touched bytes, the section bitmap, and access counters.
+ * bytes_used only needs the mask; homogenity needs sum and maximum of
+ * the per-byte access counts. Usually all bytes of an 8-byte word are
+ * accessed together, so counts are stored per word, as saturating
+ * 4 bit difference to the line maximum. Lines accessed at sub-word
+ * granularity, with word counts drifting too far apart, or touched by
+ * an overflow section are spilled to exact per-byte counters in a pool.
+ */
+#define LINE_WORDS (LINESIZE/8)
+#define DEFICIT_MAX 15
+#define COUNT_MAX ((1 << 24) - 1)
+
 typedef struct _cacheline {
     Addr tag;            // 64 bit architecture
-    int accesses[LINESIZE];
-    SectionList sections;
+    unsigned long long touched;   // bytes accessed since fill
+    unsigned long long sections;  // bitmap of Section.bit
+    unsigned int max : 24;        // access count of most used word
+    unsigned int dirty : 1;       // modified, needs write-back on eviction
+    unsigned int prefetched : 1;  // filled by prefetcher, no demand access yet
+    unsigned int spilled : 1;     // exact counters in spill pool
+    unsigned int way : 5;         // physical way, for way partitioning
+    union {
+        unsigned int deficit;     // per word: max - count, 4 bit each
+        unsigned int spill;       // index into spill pool, if spilled
+    };
+    unsigned int pf_time;         // prefetch issue time (see pf_clock), if prefetched
 } Cacheline;
 
+typedef struct _linespill {
+    unsigned int accesses[LINESIZE];
+    SectionList overflow;         // sections without own bit
+    int next_free;
+} LineSpill;
+
+LineSpill* spills = NULL;
+int spills_size = 0;
+int spills_free = -1;
+unsigned int spills_max = 0, spills_used = 0;
 
 Cacheline* cache;
 
@@ -191,280 +296,3485 @@ SectionList sections={NULL,NULL};
 DataList dataList={NULL,NULL};
 unsigned int misses=0;
 
+/* write policy: allocate line on store miss (else write around) */
+int write_allocate = TRUE;
+
+/* memory traffic in bytes, including write-back of dirty lines at exit */
+unsigned long long mem_read = 0, mem_written = 0;
+unsigned long long writebacks = 0;
+
+/* report memory traffic at exit (setting "traffic") */
+int traffic_report = FALSE;
+
+/* valid lines replaced by fills, on demand misses and prefetches */
+unsigned long long evictions = 0;
+
+
+// fresh line for <tag>, without accesses
+void line_init(Cacheline* l, Addr tag)
+{
+    memset(l, 0, sizeof(Cacheline));
+    l->tag = tag;
+}
+
+// move metadata of <l> to exact per-byte counters
+void line_spill(Cacheline* l)
+{
+    int i, s;
+    LineSpill* sp;
+
+    if (l->spilled) return;
+    if (spills_free < 0) {
+        int n = spills_size ? 2 * spills_size : 256;
+        spills = realloc(spills, n * sizeof(LineSpill));
+        for (i = spills_size; i < n; i++)
+            spills[i].next_free = (i+1 < n) ? i+1 : -1;
+        spills_free = spills_size;
+        spills_size = n;
+    }
+    s = spills_free;
+    sp = &spills[s];
+    spills_free = sp->next_free;
+    if (++spills_used > spills_max) spills_max = spills_used;
+
+    for (i = 0; i < LINESIZE; i++)
+        sp->accesses[i] = ((l->touched >> i) & 1) ?
+            l->max - ((l->deficit >> (4*(i/8))) & DEFICIT_MAX) : 0;
+    sp->overflow.first = NULL;
+    sp->overflow.last = NULL;
+    l->spilled = 1;
+    l->spill = s;
+}
+
+void line_unspill(Cacheline* l)
+{
+    LineSpill* sp = &spills[l->spill];
+
+    freeSectionList(&sp->overflow, TRUE);
+    sp->next_free = spills_free;
+    spills_free = l->spill;
+    spills_used--;
+    l->spilled = 0;
+    l->deficit = 0;
+}
+
+// line <l> got accessed by <section>
+void line_add_section(Cacheline* l, Section* section)
+{
+    l->sections |= 1ULL << section->bit;
+    if (section->bit != SECTION_OVERFLOW) return;
+    line_spill(l);
+    addSectionChecked(&(spills[l->spill].overflow), section);
+}
+
+// count an access to the bytes in <mask> of line <l>
+void line_touch(Cacheline* l, unsigned long long mask)
+{
+    unsigned int count[LINE_WORDS];
+    unsigned int max = l->max, deficit = 0;
+    int w;
+
+    if (!l->spilled) {
+        for (w = 0; w < LINE_WORDS; w++) {
+            unsigned int m = (mask >> (8*w)) & 0xff;
+            count[w] = ((l->touched >> (8*w)) & 0xff) ?
+                l->max - ((l->deficit >> (4*w)) & DEFICIT_MAX) : 0;
+            if (m == 0) continue;
+            if (m != 0xff) break;
+            if (++count[w] > max) max = count[w];
+        }
+        if (w == LINE_WORDS && max <= COUNT_MAX) {
+            for (w = 0; w < LINE_WORDS; w++) {
+                if (count[w] == 0) continue;
+                if (max - count[w] > DEFICIT_MAX) break;
+                deficit |= (max - count[w]) << (4*w);
+            }
+        }
+        if (w == LINE_WORDS && max <= COUNT_MAX) {
+            l->max = max;
+            l->deficit = deficit;
+            l->touched |= mask;
+            return;
+        }
+        line_spill(l);
+    }
+    l->touched |= mask;
+    for (w = 0; w < LINESIZE; w++)
+        if ((mask >> w) & 1)
+            spills[l->spill].accesses[w]++;
+}
+
+void select_kernel();
+void whatif_clear();
+void vbuf_clear();
+
+/* way partitioning, see below */
+int cat_enabled = FALSE;
+unsigned int cat_mask = ~0u;   // ways the current access may fill
+void cat_clear();
+void cat_select(Addr a);
+void cat_fill(int set_no, int way);
+
+// position of LRU line in <set> in a way allowed by cat_mask
+static inline int cat_victim(Cacheline* set, int ways)
+{
+    int i;
+    for (i = ways - 1; i > 0; i--)
+        if ((cat_mask >> set[i].way) & 1)
+            break;
+    return i;
+}
 
 void cache_clear()
 {
+	select_kernel();
+	whatif_clear();
 	free(cache);
 	cache = (Cacheline* ) malloc(sizeof(Cacheline) * cachelines);
     int i;
-    int j;
-    for(i=0; i<cachelines; i++) 
-    {
-      cache[i].tag = 0;
-      for(j=0;j<LINESIZE;++j)
-	cache[i].accesses[j]=0;
+    for(i=0; i<cachelines; i++) {
+      line_init(&cache[i], 0);
+      cache[i].way = i % setsize;
     }
+    // lines were dropped, so are their spilled counters
+    free(spills);
+    spills = NULL;
+    spills_size = 0;
+    spills_free = -1;
+    spills_used = 0;
+    cat_clear();
+    vbuf_clear();
+}
+
+/* Burst sampling: statistics are only updated while measuring, not
+ * while an access just warms up the cache, see mem_access() */
+int measuring = TRUE;
+
+/* 3C miss classification, see below */
+int classify_misses = FALSE;
+#define MISS_COMPULSORY 0
+#define MISS_CAPACITY   1
+#define MISS_CONFLICT   2
+int shadow_ref(Addr line);
+int classify_miss(Addr line, int shadow_hit);
+
+/* victim and miss buffers, see below */
+#define VBUF_NONE   0
+#define VBUF_VICTIM 1
+#define VBUF_MISS   2
+int vbuf_mode = VBUF_NONE;
+void vbuf_miss(Addr line, int miss_class);
+void vbuf_evicted(Addr line);
+
+/* per-set statistics, see below */
+int set_stats = FALSE;
+void set_stat_access(int set_no);
+void set_stat_miss(int set_no, Addr a, int evict);
+
+/* prefetch statistics, see prefetcher section below */
+void pf_demand_hit(Cacheline* l);
+void pf_evicted(Cacheline* l);
+void pf_demand_miss(Addr line);
+
+void save_section(Section* section, int cl_bytes_used, int cl_homogenity, int dirty)
+{
+	section->bytes_used[cl_bytes_used]++;
+	section->homogenity[cl_homogenity]++;
+	section->misses++;
+	section->mem_read+=LINESIZE;
+	if(dirty)
+		section->mem_written+=LINESIZE;
 }
 
-void save_line(Cacheline l)
+// release metadata of line <l>, attributing its usage to its sections
+void save_line(Cacheline* l)
 {
-  int cl_bytes_used=0;
+  int cl_bytes_used=__builtin_popcountll(l->touched);
   int sum_accesses=0;
-  int max_accesses=0;
+  unsigned int max_accesses=0;
   int i;
   SectionNode* nextSection;
-  for(i=0;i<LINESIZE;++i)
+  if(l->spilled)
+  {
+    for(i=0;i<LINESIZE;++i)
+    {
+      sum_accesses+=spills[l->spill].accesses[i];
+      if(spills[l->spill].accesses[i]>max_accesses)
+        max_accesses=spills[l->spill].accesses[i];
+    }
+  }
+  else
   {
-    if(l.accesses[i]>0)
-      cl_bytes_used++;
-    sum_accesses+=l.accesses[i];
-    if(l.accesses[i]>max_accesses)
-      max_accesses=l.accesses[i];
-  } 
-  if(max_accesses==0)
-	return;
-  int cl_homogenity=((float)(sum_accesses)/(float)(LINESIZE))/(float)max_accesses*100.0f;
-  if(sum_accesses>0)
+    max_accesses=l->max;
+    for(i=0;i<LINE_WORDS;++i)
+      if((l->touched >> (8*i)) & 0xff)
+        sum_accesses+=8*(l->max - ((l->deficit >> (4*i)) & DEFICIT_MAX));
+  }
+  if(max_accesses>0)
   {
-	nextSection=l.sections.first;
-	while(nextSection!=NULL)
+	int cl_homogenity=((float)(sum_accesses)/(float)(LINESIZE))/(float)max_accesses*100.0f;
+	for(i=0;i<SECTION_OVERFLOW;++i)
+	  if((l->sections >> i) & 1)
+		save_section(section_of_bit[i], cl_bytes_used, cl_homogenity, l->dirty);
+	if(l->spilled)
 	{
-		nextSection->section->bytes_used[cl_bytes_used]++;
-    	nextSection->section->homogenity[cl_homogenity]++;
-		nextSection->section->misses++;
-		nextSection=nextSection->next;	
+	  nextSection=spills[l->spill].overflow.first;
+	  while(nextSection!=NULL)
+	  {
+		save_section(nextSection->section, cl_bytes_used, cl_homogenity, l->dirty);
+		nextSection=nextSection->next;
+	  }
 	}
-	freeSectionList(&l.sections,TRUE);   
   }
+  if(l->spilled)
+	line_unspill(l);
+  l->touched=0;
+  l->sections=0;
+  l->max=0;
+}
+
+// write back <l> if dirty, when evicted or at exit
+void writeback_line(Cacheline* l)
+{
+    if (!l->dirty) return;
+    if (measuring) {
+        writebacks++;
+        mem_written += LINESIZE;
+    }
+    l->dirty = 0;
+}
+
+// replace line <v> of set <set_no> on a fill, by demand miss or prefetch
+static inline void evict_line(Cacheline* set, int v, int set_no)
+{
+    Cacheline* l = &set[v];
+
+    if (l->tag != 0) {
+        if (measuring)
+            evictions++;
+        if (vbuf_mode == VBUF_VICTIM)
+            vbuf_evicted(l->tag * SETS + set_no);
+    }
+    save_line(l);
+    pf_evicted(l);
+    writeback_line(l);
 }
 
-// a reference into a set of the cache, return 1 on hit
-int cache_setref(int set_no, Addr tag, int byte)
+// a reference to <n> bytes from <byte> of a line in a set of the cache
+// with <ways> lines, return 1 on hit.
+// With write-around (no write-allocate), store misses do not install a
+// line, and each line fragment written around counts as one miss.
+// Always inlined, so that kernels below get a constant <ways>
+static inline __attribute__((always_inline))
+int cache_setref_ways(int set_no, Addr tag, int byte, int n, int write, const int ways)
 {
-    int i, j;
-    Cacheline* set = cache + set_no * setsize;
+    int i, j, victim, way, miss_class = -1;
+    Cacheline* set = cache + set_no * ways;
     unsigned old_mask;
+    int shadow_hit = classify_misses ? shadow_ref(tag * SETS + set_no) : 0;
 
     /* Test all lines in the set for a tag match
      * If the tag is another than the MRU, move it into the MRU spot, count access
      * and shuffle the rest down.
      */
-    for (i = 0; i < setsize; i++) {
+#pragma GCC unroll 16
+    for (i = 0; i < ways; i++) {
         if (tag == set[i].tag) {
 		 Cacheline accessed_line=set[i];
+#pragma GCC unroll 16
             for (j = i; j > 0; j--) {
                 set[j]= set[j - 1];
             }
             set[0] = accessed_line;
-            set[0].accesses[byte]++;
-			addSectionChecked(&(set[0].sections),currentSection);
+            if (set[0].prefetched)
+                pf_demand_hit(&set[0]);
+            if (write)
+                set[0].dirty = 1;
             return 1;
         }
     }
 
+    // with way partitioning, only lines in allowed ways are replaced
+    victim = cat_enabled ? cat_victim(set, ways) : ways - 1;
+
+    if (classify_misses)
+        miss_class = classify_miss(tag * SETS + set_no, shadow_hit);
+    if (set_stats && measuring)
+        set_stat_miss(set_no, (tag * SETS + set_no) * LINESIZE + byte,
+                      !(write && !write_allocate) && set[victim].tag != 0);
+
+    // write-around: one miss per line fragment, written bytes to memory.
+    // No line is fetched or installed, so there is nothing to look up in
+    // or put into a victim/miss buffer, and no pollution by a prefetch.
+    // The prefetcher still is trained by the store, see mem_access()
+    if (write && !write_allocate) {
+        if (measuring) {
+            misses++;
+            mem_written += n;
+            currentSection->mem_written += n;
+        }
+        return 0;
+    }
+
+    // look up in buffer before the victim may be put there
+    if (vbuf_mode != VBUF_NONE)
+        vbuf_miss(tag * SETS + set_no, miss_class);
+
     /* A miss; save LRU to file, install this tag as MRU, shuffle rest down. */
-    save_line(set[setsize-1]);    
-    for (j = setsize - 1; j > 0; j--) {
+    evict_line(set, victim, set_no);
+    way = set[victim].way;
+#pragma GCC unroll 16
+    for (j = victim; j > 0; j--) {
         set[j]= set[j - 1];
     }
-	misses++;
+	if (measuring) {
+		misses++;
+		mem_read += LINESIZE;
+	}
+	pf_demand_miss(tag * SETS + set_no);
 
-    Cacheline new_line;
-    new_line.tag=tag;
-    for(i=0;i<LINESIZE;++i)
-    {
-        new_line.accesses[i]=0;
-    }
-    new_line.accesses[byte]++;
-	new_line.sections.first=NULL;
-	new_line.sections.last=NULL;
-	addSection(&(new_line.sections),currentSection);
-    set[0]=new_line;
+    line_init(&set[0], tag);
+    set[0].way = way;
+    set[0].dirty = write;
+    if (cat_enabled)
+        cat_fill(set_no, way);
     return 0;
 }
 
-// a reference at address <a> with size <s>, return 1 on hit
-int cache_ref(Addr a, int size)
+/* Kernels specialized for common associativities: way loops unrolled.
+ * Set index and tag are computed with shift and mask in cache_ref()
+ * if the number of sets is a power of two. */
+typedef int (*SetrefKernel)(int set_no, Addr tag, int byte, int n, int write);
+
+#define SETREF_KERNEL(ways) \
+int cache_setref_##ways(int set_no, Addr tag, int byte, int n, int write) \
+{ return cache_setref_ways(set_no, tag, byte, n, write, ways); }
+
+SETREF_KERNEL(1)
+SETREF_KERNEL(2)
+SETREF_KERNEL(4)
+SETREF_KERNEL(8)
+SETREF_KERNEL(12)
+SETREF_KERNEL(16)
+SETREF_KERNEL(32)
+
+// generic fallback for any associativity
+int cache_setref(int set_no, Addr tag, int byte, int n, int write)
+{
+    return cache_setref_ways(set_no, tag, byte, n, write, setsize);
+}
+
+SetrefKernel cache_setref_kernel = cache_setref_16;
+
+// select kernel and derived parameters for current geometry
+void select_kernel()
+{
+    cache_sets = cachelines / setsize;
+    for (set_bits = 0; (1 << set_bits) < cache_sets; set_bits++);
+    if ((1 << set_bits) != cache_sets)
+        set_bits = -1;
+
+    switch (setsize) {
+    case 1:  cache_setref_kernel = cache_setref_1;  break;
+    case 2:  cache_setref_kernel = cache_setref_2;  break;
+    case 4:  cache_setref_kernel = cache_setref_4;  break;
+    case 8:  cache_setref_kernel = cache_setref_8;  break;
+    case 12: cache_setref_kernel = cache_setref_12; break;
+    case 16: cache_setref_kernel = cache_setref_16; break;
+    case 32: cache_setref_kernel = cache_setref_32; break;
+    default: cache_setref_kernel = cache_setref;    break;
+    }
+    DEBUG(printf("Cache kernel for %d sets (%s), %d ways%s\n", cache_sets,
+                 set_bits >= 0 ? "shift/mask" : "division", setsize,
+                 cache_setref_kernel == cache_setref ? " (generic)" : "");)
+}
+
+// set and tag of line address <line>
+static inline int line_set(Addr line)
+{
+    return (set_bits >= 0) ? (int)(line & (cache_sets - 1)) : (int)(line % cache_sets);
+}
+
+static inline Addr line_tag(Addr line)
+{
+    return (set_bits >= 0) ? (line >> set_bits) : (line / cache_sets);
+}
+
+/* TLB simulation, see below */
+int tlb_enabled = FALSE;
+
+void tlb_access(Addr a, int size);
+
+/* data ranges overlapping the current access, see cache_ref() */
+Data** overlap = NULL;
+int overlap_size = 0;
+int noverlap = 0;
+int data_count = 0;
+
+// a reference at address <a> with size <s>, return 1 on hit.
+// The access is split into fragments within one cache line each,
+// every fragment is one lookup updating all its bytes at once.
+// Large accesses (TR_DATA_RANGE) walk their lines sequentially:
+// set and tag are advanced instead of recomputed, and only data
+// ranges overlapping the access are checked per line.
+int cache_ref(Addr a, int size, int write)
 {
-    int i;
     int hit=1;
-	int ref_hit=1;
 	DataNode* nextData;
-	SectionNode* nextSection;
-	int found=FALSE;
 	int lastSet=-1;
-    for(i=0;i<size;++i)
+	Addr end=a+size;
+	int r;
+	// before setting up the globals below: the page walk of a TLB
+	// miss may reference the cache recursively
+	if(tlb_enabled)
+		tlb_access(a,size);
+	noverlap=0;
+	if(overlap_size < data_count)
+	{
+		overlap_size = data_count;
+		overlap = realloc(overlap, overlap_size * sizeof(Data*));
+	}
+	for(nextData=dataList.first; nextData!=NULL; nextData=nextData->next)
+		if(nextData->data->start < end && nextData->data->end >= a)
+			overlap[noverlap++]=nextData->data;
+	if(cat_enabled)
+		cat_select(a);
+
+    int  set = line_set(a / LINESIZE);
+    Addr tag = line_tag(a / LINESIZE);
+    while(a<end)
     {
-        int  set = ( (a+i) / LINESIZE) & (SETS-1);
-        Addr tag = (a+i) / LINESIZE / SETS;
-        int byte = (a+i)& (LINESIZE-1);   // equals (a+i)%LINESIZE
-		ref_hit=cache_setref(set,tag,byte);
-		hit*=ref_hit;
-		if(lastSet!=set)
+        int byte = a & (LINESIZE-1);   // equals a%LINESIZE
+        int n = LINESIZE - byte;
+        if((Addr)n > end-a)
+            n = end-a;
+		hit&=cache_setref_kernel(set,tag,byte,n,write);
+		if(!measuring)
+			;  // warm-up only: no statistics
+		else if(cache[set*setsize].tag!=tag)
 		{
+			// store written around the cache: attribute to data range
+			if(set_stats && lastSet!=set)
+				set_stat_access(set);
 			lastSet=set;
-
-			nextData=dataList.first;
-			while(nextData!=NULL)
+			for(r=0; r<noverlap; r++)
+			{
+				Addr from = (a > overlap[r]->start) ? a : overlap[r]->start;
+				Addr to = (a+n-1 < overlap[r]->end) ? a+n-1 : overlap[r]->end;
+				if(from<=to)
+					overlap[r]->section->mem_written+=to-from+1;
+			}
+		}
+		else
+		{
+			// usage of lines by sections, for their histograms
+			Cacheline* line=&cache[set*setsize];
+			if(lastSet!=set)
 			{
-				if(a+i>=nextData->data->start && a+i<=nextData->data->end)
-					addSectionChecked(&(cache[set*setsize+0].sections),nextData->data->section);
-				nextData=nextData->next;
+				lastSet=set;
+				if(set_stats)
+					set_stat_access(set);
+
+				for(r=0; r<noverlap; r++)
+					if(a>=overlap[r]->start && a<=overlap[r]->end)
+						line_add_section(line,overlap[r]->section);
 			}
+			line_add_section(line,currentSection);
+			line_touch(line,((n==LINESIZE) ? ~0ULL : ((1ULL<<n)-1)) << byte);
+		}
+		a+=n;
+		// next line
+		if(++set == cache_sets)
+		{
+			set=0;
+			tag++;
 		}
     }
     return hit;
 }
 
 
+void print_traffic()
+{
+	SectionNode* next=sections.first;
+
+	if(!traffic_report)
+		return;
+	printf("\nMemory traffic (%s): read %llu bytes, written %llu bytes (%llu write-backs)\n",
+		write_allocate ? "write-allocate" : "write-around",
+		mem_read, mem_written, writebacks);
+	while(next!=NULL)
+	{
+		if(next->section->mem_read || next->section->mem_written)
+			printf("  %-20s read %llu, written %llu\n", next->section->description,
+				next->section->mem_read, next->section->mem_written);
+		next=next->next;
+	}
+}
+
 /* ----------------------------------------------------------------*/
 
-/* global counters for cache simulation */
-int loads = 0, stores = 0, lmisses = 0, smisses = 0;
+/*
+ * 3C miss classification (compulsory, capacity, conflict).
+ *
+ * Compulsory: first access to a line, found via a sparse bitmap over
+ * line addresses (hash table of 512-line chunks, 64 bytes each).
+ * Capacity: miss also in a shadow fully-associative LRU cache of the
+ * same capacity, implemented as hash map from line to node plus an
+ * intrusive LRU list over the node array, so each reference is O(1).
+ * Conflict: all other misses.
+ */
 
-/* thread executing next memory accesses */
-int tid = 0;
+#define TOUCH_CHUNK_LINES 512
 
+typedef struct _touchchunk {
+	Addr key;            // chunk number + 1, 0: empty
+	unsigned long long bits[TOUCH_CHUNK_LINES / 64];
+} TouchChunk;
 
-void run_tid(ev_run_tid* e)
-{  
-  // not really needed here: we assume a shared cache for all threads
-  tid = e->tid;
+TouchChunk* touched = NULL;
+unsigned int touched_size = 0, touched_used = 0;
+
+typedef struct _fanode {
+	Addr line;
+	int prev, next;      // LRU list, -1: none
+} FANode;
+
+/* Fully-associative LRU cache of line addresses: hash map from line to
+ * node (linear probing) plus an intrusive LRU list over the node array.
+ * Used as shadow cache here, and for victim/miss buffers below. */
+typedef struct _facache {
+	FANode* node;
+	int nodes, used;
+	int mru, lru;
+	int* map;            // node index, -1: empty
+	unsigned int map_size;
+} FACache;
+
+FACache shadow = { NULL };
+
+static inline unsigned int line_hash(Addr a)
+{
+	return (unsigned int)((a * 0x9E3779B97F4A7C15ULL) >> 32);
 }
 
-void data_read(ev_data_read* e)
+// mark line as touched, return 1 if it was touched before
+int touch_line(Addr line)
 {
-  int res;
-  res = cache_ref(e->addr, e->len);
-  // printf(" > Load  by T%d at %p, size %2d: %s\n",
-  //	 tid, (void*) e->addr, e->len, res ? "Hit ":"Miss");
-  loads++;
-  if (res == 0) lmisses++;
+	Addr key = line / TOUCH_CHUNK_LINES + 1;
+	unsigned int i, bit = line % TOUCH_CHUNK_LINES;
+	unsigned long long mask = 1ULL << (bit & 63);
+	int old;
+
+	if (2 * (touched_used + 1) > touched_size) {
+		TouchChunk* old_chunks = touched;
+		unsigned int j, old_size = touched_size;
+		touched_size = old_size ? 2 * old_size : 1024;
+		touched = calloc(touched_size, sizeof(TouchChunk));
+		for (j = 0; j < old_size; j++) {
+			if (old_chunks[j].key == 0) continue;
+			i = line_hash(old_chunks[j].key) & (touched_size - 1);
+			while (touched[i].key != 0)
+				i = (i + 1) & (touched_size - 1);
+			touched[i] = old_chunks[j];
+		}
+		free(old_chunks);
+	}
+
+	i = line_hash(key) & (touched_size - 1);
+	while (touched[i].key != key) {
+		if (touched[i].key == 0) {
+			touched[i].key = key;
+			touched_used++;
+			break;
+		}
+		i = (i + 1) & (touched_size - 1);
+	}
+	old = (touched[i].bits[bit / 64] & mask) != 0;
+	touched[i].bits[bit / 64] |= mask;
+	return old;
 }
 
-void data_write(ev_data_write* e)
+void fa_init(FACache* c, int nodes)
 {
-  int res;
-  res = cache_ref(e->addr, e->len);
-  // printf(" > Store by T%d at %p, size %2d: %s\n",
-  //	 tid, (void*) e->addr, e->len, res ? "Hit ":"Miss");
-  stores++;
-  if (res == 0) smisses++;
+	unsigned int i;
+
+	free(c->node);
+	free(c->map);
+	c->nodes = nodes;
+	c->node = malloc(nodes * sizeof(FANode));
+	c->used = 0;
+	c->mru = c->lru = -1;
+	for (c->map_size = 1; c->map_size < 2 * (unsigned int)nodes; )
+		c->map_size *= 2;
+	c->map = malloc(c->map_size * sizeof(int));
+	for (i = 0; i < c->map_size; i++)
+		c->map[i] = -1;
 }
 
-void configure(ev_simplesim_configure* e)
+static void fa_unlink(FACache* c, int n)
 {
-	if(strcmp(e->setting, "cachelines") == 0){
-		cachelines = e->value;
-		DEBUG(printf("Reconfigured for %d cachelines\n", cachelines);)
-	}else if(strcmp(e->setting, "setsize") == 0){
-		setsize = e->value;
-	}
-	cache_clear();
+	FANode* node = c->node;
+
+	if (node[n].prev >= 0) node[node[n].prev].next = node[n].next;
+	else c->mru = node[n].next;
+	if (node[n].next >= 0) node[node[n].next].prev = node[n].prev;
+	else c->lru = node[n].prev;
 }
 
-void data_define(ev_simplesim_define_data* define_data){
-  SectionNode* nextSection=sections.first;
-	int lowestID=0;
-	Data* newData;
-	int i;
-	while(nextSection!=NULL)
-	{
-		if(nextSection->section->id < lowestID)
-			lowestID=nextSection->section->id;
-		nextSection=nextSection->next;
-	}
-	newData=malloc(sizeof(Data));
-	newData->start=define_data->start;
-	newData->end=define_data->start+define_data->size;
-	newData->section=malloc(sizeof(Section));
-	memset ( newData->section->bytes_used, 0, (LINESIZE+1)*sizeof (int) );
-	memset ( newData->section->homogenity, 0, 101*sizeof (int) );
-	newData->section->id=lowestID-1;
-	newData->section->misses=0;
-	for(i=0;i<64;++i)
-	{
-		newData->section->description[i] = define_data->description[i];
+static void fa_push_mru(FACache* c, int n)
+{
+	c->node[n].prev = -1;
+	c->node[n].next = c->mru;
+	if (c->mru >= 0) c->node[c->mru].prev = n;
+	c->mru = n;
+	if (c->lru < 0) c->lru = n;
+}
+
+// remove map slot <i>, backward shift deletion for linear probing
+static void fa_map_remove(FACache* c, unsigned int i)
+{
+	unsigned int mask = c->map_size - 1;
+	unsigned int j = i, home;
+
+	while (1) {
+		j = (j + 1) & mask;
+		if (c->map[j] < 0) break;
+		home = line_hash(c->node[c->map[j]].line) & mask;
+		// move entry j to i if its home is not in (i, j]
+		if (((j - home) & mask) >= ((j - i) & mask)) {
+			c->map[i] = c->map[j];
+			i = j;
+		}
 	}
-	addData(&dataList,newData);
-	addSection(&sections,newData->section);
+	c->map[i] = -1;
+}
 
-  DEBUG(printf("user request, data define %s, start: %p, size %d\n", define_data->description, (void *) define_data->start, define_data->size);)
+// map slot of <line>, or free slot where it is to be inserted
+static inline unsigned int fa_slot(FACache* c, Addr line)
+{
+	unsigned int mask = c->map_size - 1;
+	unsigned int i = line_hash(line) & mask;
+	int n;
+
+	while ((n = c->map[i]) >= 0 && c->node[n].line != line)
+		i = (i + 1) & mask;
+	return i;
 }
 
-void change_section(ev_simplesim_change_section* section_change){
-	Section* found=NULL;
-	SectionNode* nextSection=sections.first;
-	Section* section;
-	int i;
-	while(nextSection!=NULL)
-	{
-		if(nextSection->section->id==section_change->id)
-		{
-			found=nextSection->section;
+// reference to <line>, return 1 on hit. On miss, <line> is inserted
+// as MRU, evicting the LRU line if full
+int fa_ref(FACache* c, Addr line)
+{
+	unsigned int i = fa_slot(c, line);
+	int n = c->map[i];
+
+	if (n >= 0) {
+		if (n != c->mru) {
+			fa_unlink(c, n);
+			fa_push_mru(c, n);
 		}
-		nextSection=nextSection->next;
+		return 1;
 	}
-	if(found==NULL)
-	{
-		section=malloc(sizeof(Section));
-		memset ( section->bytes_used, 0, (LINESIZE+1)*sizeof (int) );
-		memset ( section->homogenity, 0, 101*sizeof (int) );
-		section->id=section_change->id;
-		section->misses=0;
-		for(i=0;i<64;++i)
-		{
-			section->description[i] = section_change->description[i];
-	   	}
-		addSection(&sections,section);
-		currentSection=section;
+
+	if (c->used < c->nodes)
+		n = c->used++;
+	else {
+		// evict LRU
+		n = c->lru;
+		fa_map_remove(c, fa_slot(c, c->node[n].line));
+		fa_unlink(c, n);
+		// slot for new line may have moved
+		i = fa_slot(c, line);
+	}
+	c->node[n].line = line;
+	c->map[i] = n;
+	fa_push_mru(c, n);
+	return 0;
+}
+
+// remove <line>, return 1 if it was cached
+int fa_remove(FACache* c, Addr line)
+{
+	unsigned int i = fa_slot(c, line);
+	int n = c->map[i], last;
+	FANode* node = c->node;
+
+	if (n < 0) return 0;
+	fa_map_remove(c, i);
+	fa_unlink(c, n);
+
+	// keep used nodes dense: move last one into the hole
+	last = --c->used;
+	if (n != last) {
+		c->map[fa_slot(c, node[last].line)] = n;
+		node[n] = node[last];
+		if (node[n].prev >= 0) node[node[n].prev].next = n;
+		else c->mru = n;
+		if (node[n].next >= 0) node[node[n].next].prev = n;
+		else c->lru = n;
 	}
+	return 1;
+}
+
+// reference to line in shadow fully-associative cache, return 1 on hit
+int shadow_ref(Addr line)
+{
+	if (shadow.node == NULL || shadow.nodes != cachelines)
+		fa_init(&shadow, cachelines);
+	return fa_ref(&shadow, line);
+}
+
+int classify_miss(Addr line, int shadow_hit)
+{
+	int c;
+
+	if (!touch_line(line))
+		c = MISS_COMPULSORY;
+	else if (!shadow_hit)
+		c = MISS_CAPACITY;
+	else
+		c = MISS_CONFLICT;
+	if (!measuring)
+		return c;
+	if (c == MISS_COMPULSORY)
+		currentSection->miss_compulsory++;
+	else if (c == MISS_CAPACITY)
+		currentSection->miss_capacity++;
 	else
+		currentSection->miss_conflict++;
+	return c;
+}
+
+void print_classification()
+{
+	SectionNode* next=sections.first;
+	Section* s;
+
+	if(!classify_misses)
+		return;
+	printf("\nMiss classification (compulsory / capacity / conflict):\n");
+	while(next!=NULL)
 	{
-		currentSection=found;
+		s=next->section;
+		if(s->miss_compulsory || s->miss_capacity || s->miss_conflict)
+			printf("  %-20s %u / %u / %u\n", s->description,
+				s->miss_compulsory, s->miss_capacity, s->miss_conflict);
+		next=next->next;
 	}
-  	DEBUG(printf("user request, change section ID: %d \n",section_change->id);)//
 }
 
-int main(int argc, char* argv[])
-{
-    
-    cache_clear();
-    
-    Section* mainSection=malloc(sizeof(Section));
-    memset ( mainSection->bytes_used, 0, (LINESIZE+1)*sizeof (int) );
-    memset ( mainSection->homogenity, 0, 101*sizeof (int) );
-    mainSection->id=0;
-    mainSection->misses=0;
-    int i;
-    char* desc="default";
-    for(i=0;desc[i]!='\0';++i)
-    {
-	    mainSection->description[i] = desc[i];
-    }
-    mainSection->description[i]='\0';
-    currentSection=mainSection;
-    addSection(&sections,mainSection);
-    
-    shm_buf* buf;
-    shm_rb* rb;
-    rb_chunk* chunk;
-    tr_event* e;
+/* ----------------------------------------------------------------*/
 
-    /* initialize event passing via shared memory */
-    buf = shm_init(argc, argv);
-    rb = open_rb(buf, "tr_main");
-    if (!rb) {
-      printf("Cannot open ring buffer 'tr_main'\n");
-      exit(1);
-    }
+/*
+ * Victim and miss buffers: small fully-associative buffers behind the
+ * cache, looked up on each miss installing a line (store misses written
+ * around the cache do not). The buffer is an FACache, so lookup is O(1)
+ * also with many entries.
+ * Victim buffer ("victim_cache" entries): gets the lines evicted from
+ * the cache. On a hit, the line is swapped back into the cache.
+ * Miss buffer ("miss_cache" entries): gets the lines filled on misses.
+ * Cache statistics are not changed by the buffer: hits are reported
+ * separately as misses served without memory access.
+ */
 
+int vbuf_entries = 0;
+FACache vbuf = { NULL };
+unsigned long long vbuf_lookups = 0, vbuf_hits = 0;
+unsigned long long vbuf_conflicts = 0, vbuf_conflict_hits = 0;
 
+// buffer contents are dropped with the cache
+void vbuf_clear()
+{
+	if (vbuf_mode != VBUF_NONE)
+		fa_init(&vbuf, vbuf_entries);
+}
 
-    chunk = open_first(rb);
-    while( (e = (tr_event*) next_event(&chunk)) ) {
-      switch(e->tag) {
-      case TR_RUN_TID:
+// miss of the cache for <line>, of 3C class <miss_class> (-1: unknown)
+void vbuf_miss(Addr line, int miss_class)
+{
+	int hit;
+
+	if (vbuf_mode == VBUF_VICTIM)
+		hit = fa_remove(&vbuf, line);
+	else
+		hit = fa_ref(&vbuf, line);
+	if (!measuring)
+		return;
+	vbuf_lookups++;
+	if (miss_class == MISS_CONFLICT)
+		vbuf_conflicts++;
+	if (!hit)
+		return;
+	vbuf_hits++;
+	currentSection->vbuf_hits++;
+	if (miss_class == MISS_CONFLICT)
+		vbuf_conflict_hits++;
+}
+
+void vbuf_evicted(Addr line)
+{
+	fa_ref(&vbuf, line);
+}
+
+void vbuf_prefetched(Addr line)
+{
+	fa_remove(&vbuf, line);
+}
+
+void print_vbuf()
+{
+	SectionNode* next=sections.first;
+
+	if(vbuf_mode == VBUF_NONE)
+		return;
+	printf("\n%s cache (%d entries): %llu of %llu misses served (%.2f%%)\n",
+		(vbuf_mode == VBUF_VICTIM) ? "Victim" : "Miss", vbuf_entries,
+		vbuf_hits, vbuf_lookups,
+		vbuf_lookups ? 100.0 * vbuf_hits / vbuf_lookups : 0.0);
+	if(classify_misses)
+		printf("  conflict misses served: %llu of %llu (%.2f%%)\n",
+			vbuf_conflict_hits, vbuf_conflicts,
+			vbuf_conflicts ? 100.0 * vbuf_conflict_hits / vbuf_conflicts : 0.0);
+	while(next!=NULL)
+	{
+		if(next->section->vbuf_hits)
+			printf("  %-20s %u\n", next->section->description,
+				next->section->vbuf_hits);
+		next=next->next;
+	}
+}
+
+/* ----------------------------------------------------------------*/
+
+/*
+ * Per-set access, miss and eviction counters.
+ * With "set_window" > 0, counters of each window of that many
+ * accesses are written to SET_STATS_FILE, one line per set:
+ *   window set accesses misses evictions
+ * The hotspot report lists the sets with most misses relative to the
+ * average, with the registered data ranges contributing to them.
+ */
+
+#define SET_STATS_FILE "simplesim-sets.txt"
+#define SET_HOTSPOTS 8
+
+int set_window = 0;           // accesses per window, 0: whole run
+int set_count = 0;            // sets the counters were allocated for
+unsigned int* set_accesses = NULL;
+unsigned int* set_misses = NULL;
+unsigned int* set_evictions = NULL;
+unsigned int* win_accesses = NULL;
+unsigned int* win_misses = NULL;
+unsigned int* win_evictions = NULL;
+unsigned int win_clock = 0, win_number = 0;
+FILE* set_file = NULL;
+
+void set_stats_clear()
+{
+	DataNode* nextData;
+
+	set_count = SETS;
+	free(set_accesses); free(set_misses); free(set_evictions);
+	free(win_accesses); free(win_misses); free(win_evictions);
+	set_accesses = calloc(set_count, sizeof(unsigned int));
+	set_misses = calloc(set_count, sizeof(unsigned int));
+	set_evictions = calloc(set_count, sizeof(unsigned int));
+	win_accesses = calloc(set_count, sizeof(unsigned int));
+	win_misses = calloc(set_count, sizeof(unsigned int));
+	win_evictions = calloc(set_count, sizeof(unsigned int));
+	for(nextData=dataList.first; nextData!=NULL; nextData=nextData->next)
+	{
+		free(nextData->data->set_misses);
+		nextData->data->set_misses = NULL;
+	}
+}
+
+void set_window_dump()
+{
+	int i;
+
+	if (set_file == NULL)
+		set_file = fopen(SET_STATS_FILE, "w");
+	if (set_file == NULL)
+		return;
+	for (i = 0; i < set_count; i++)
+	{
+		fprintf(set_file, "%u %d %u %u %u\n", win_number, i,
+			win_accesses[i], win_misses[i], win_evictions[i]);
+		win_accesses[i] = win_misses[i] = win_evictions[i] = 0;
+	}
+	win_number++;
+	win_clock = 0;
+}
+
+void set_stat_access(int set_no)
+{
+	if (set_count != SETS)
+		set_stats_clear();
+	set_accesses[set_no]++;
+	win_accesses[set_no]++;
+	if (set_window > 0 && ++win_clock == (unsigned int)set_window)
+		set_window_dump();
+}
+
+void set_stat_miss(int set_no, Addr a, int evict)
+{
+	DataNode* nextData;
+
+	if (set_count != SETS)
+		set_stats_clear();
+	set_misses[set_no]++;
+	win_misses[set_no]++;
+	if (evict)
+	{
+		set_evictions[set_no]++;
+		win_evictions[set_no]++;
+	}
+	for(nextData=dataList.first; nextData!=NULL; nextData=nextData->next)
+	{
+		Data* d = nextData->data;
+		if(a < d->start || a > d->end)
+			continue;
+		if(d->set_misses == NULL)
+			d->set_misses = calloc(set_count, sizeof(unsigned int));
+		d->set_misses[set_no]++;
+	}
+}
+
+void print_set_stats()
+{
+	int i, j, k, top[SET_HOTSPOTS], n = 0;
+	unsigned long long total = 0;
+	double avg;
+	DataNode* nextData;
+
+	if (!set_stats || set_count == 0)
+		return;
+	if (set_window > 0 && win_clock > 0)
+		set_window_dump();
+	if (set_file != NULL)
+		fclose(set_file);
+
+	for (i = 0; i < set_count; i++)
+		total += set_misses[i];
+	if (total == 0)
+		return;
+	avg = (double) total / set_count;
+
+	// insertion into sorted top list
+	for (i = 0; i < set_count; i++)
+	{
+		if (n < SET_HOTSPOTS)
+			j = n++;
+		else if (set_misses[top[n-1]] < set_misses[i])
+			j = n-1;
+		else
+			continue;
+		for (; j > 0 && set_misses[top[j-1]] < set_misses[i]; j--)
+			top[j] = top[j-1];
+		top[j] = i;
+	}
+
+	printf("\nSet hotspots (average %.1f misses per set):\n", avg);
+	for (k = 0; k < n; k++)
+	{
+		i = top[k];
+		printf("  set %5d: misses %u (%.1fx avg), accesses %u, evictions %u\n",
+			i, set_misses[i], set_misses[i] / avg,
+			set_accesses[i], set_evictions[i]);
+		for(nextData=dataList.first; nextData!=NULL; nextData=nextData->next)
+		{
+			Data* d = nextData->data;
+			if(d->set_misses && d->set_misses[i])
+				printf("      %-20s %u misses (%.0f%%)\n", d->section->description,
+					d->set_misses[i], 100.0 * d->set_misses[i] / set_misses[i]);
+		}
+	}
+	if (set_window > 0)
+		printf("  per-window counters written to '%s'\n", SET_STATS_FILE);
+}
+
+/* ----------------------------------------------------------------*/
+
+/*
+ * Hardware prefetchers, triggered by each demand access.
+ * Prefetched lines are installed as MRU without accesses, so they
+ * do not show up in the per-section line statistics unless used.
+ *
+ * Statistics:
+ * - useful:    prefetched line got a demand access
+ * - late:      useful, but demand access came within <prefetch_latency>
+ *              accesses after issue (would have been a partial miss)
+ * - useless:   prefetched line evicted without demand access
+ * - pollution: demand miss on a line evicted by a prefetch fill
+ * All demand accesses train the prefetcher, including store misses
+ * written around the cache. These do not count as pollution, as they
+ * would not have used the line.
+ */
+
+#define PF_NONE     0
+#define PF_NEXTLINE 1
+#define PF_STREAM   2
+#define PF_STRIDE   3
+
+int prefetcher = PF_NONE;
+int prefetch_degree = 1;     // lines prefetched per trigger
+int prefetch_distance = 1;   // lines ahead of the trigger
+int prefetch_latency = 8;    // in accesses, for late prefetches
+
+unsigned int pf_clock = 0;   // demand accesses seen
+unsigned int pf_issued = 0, pf_useful = 0, pf_late = 0;
+unsigned int pf_useless = 0, pf_pollution = 0;
+int pf_tagged = 0;           // current access used a prefetched line
+
+/* lines evicted by prefetch fills, direct mapped */
+#define PF_POLLUTION_FILTER 1024
+Addr pf_victims[PF_POLLUTION_FILTER];
+
+/* stream detector: recently missed regions without instruction address */
+#define PF_STREAMS 16
+#define PF_STREAM_WINDOW 4   // lines
+typedef struct _pfstream {
+	Addr line;           // last line of the stream
+	int dir;             // +1 / -1
+	int confidence;
+	unsigned int used;   // for LRU replacement
+} PFStream;
+PFStream pf_streams[PF_STREAMS];
+
+/* stride detector, keyed by instruction address,
+ * or by 4 KiB region if instruction addresses are not available */
+#define PF_STRIDES 256
+typedef struct _pfstride {
+	Addr pc;
+	Addr last;
+	long long stride;
+	int confidence;
+} PFStride;
+PFStride pf_strides[PF_STRIDES];
+
+void pf_demand_hit(Cacheline* l)
+{
+	l->prefetched = 0;
+	pf_tagged = 1;
+	if (measuring) {
+		pf_useful++;
+		if (pf_clock - l->pf_time < (unsigned int) prefetch_latency)
+			pf_late++;
+	}
+}
+
+void pf_evicted(Cacheline* l)
+{
+	if (l->prefetched && measuring)
+		pf_useless++;
+}
+
+void pf_demand_miss(Addr line)
+{
+	Addr* v = &pf_victims[line & (PF_POLLUTION_FILTER-1)];
+	if (prefetcher == PF_NONE || *v != line + 1)
+		return;
+	if (measuring)
+		pf_pollution++;
+	*v = 0;
+}
+
+// install line <line> (address / LINESIZE) if not in cache
+void cache_prefetch(Addr line)
+{
+	int i, j;
+	int set_no = line_set(line);
+	Addr tag = line_tag(line);
+	Cacheline* set = cache + set_no * setsize;
+	Cacheline* victim;
+	int v, way;
+
+	for (i = 0; i < setsize; i++)
+		if (set[i].tag == tag) return;
+
+	// prefetches fill ways of the class of the triggering access
+	v = cat_enabled ? cat_victim(set, setsize) : setsize - 1;
+	victim = &set[v];
+	way = victim->way;
+
+	if (measuring) {
+		pf_issued++;
+		mem_read += LINESIZE;
+	}
+	if (victim->tag != 0)
+		pf_victims[(victim->tag * SETS + set_no) & (PF_POLLUTION_FILTER-1)] =
+			victim->tag * SETS + set_no + 1;
+	// victim buffer stays exclusive: line moves from buffer into cache
+	if (vbuf_mode == VBUF_VICTIM)
+		vbuf_prefetched(line);
+	evict_line(set, v, set_no);
+
+	for (j = v; j > 0; j--)
+		set[j] = set[j - 1];
+
+	line_init(&set[0], tag);
+	set[0].way = way;
+	if (cat_enabled)
+		cat_fill(set_no, way);
+	set[0].prefetched = 1;
+	set[0].pf_time = pf_clock;
+}
+
+// prefetch <prefetch_degree> lines starting <prefetch_distance> lines
+// from <line> in direction <dir>
+void prefetch_lines(Addr line, int dir)
+{
+	int i;
+	for (i = 0; i < prefetch_degree; i++)
+		cache_prefetch(line + dir * (prefetch_distance + i));
+}
+
+// <train> is set on misses and on first use of a prefetched line:
+// once a stream is covered by prefetches, it has no misses left
+void pf_stream(Addr line, int train)
+{
+	int i, best = -1, lru = 0;
+	long long d;
+
+	if (!train) return;
+
+	for (i = 0; i < PF_STREAMS; i++) {
+		d = (long long)(line - pf_streams[i].line);
+		if (pf_streams[i].used && d != 0 &&
+		    d >= -PF_STREAM_WINDOW && d <= PF_STREAM_WINDOW) {
+			best = i;
+			break;
+		}
+		if (pf_streams[i].used < pf_streams[lru].used)
+			lru = i;
+	}
+
+	if (best < 0) {
+		pf_streams[lru].line = line;
+		pf_streams[lru].dir = 0;
+		pf_streams[lru].confidence = 0;
+		pf_streams[lru].used = pf_clock;
+		return;
+	}
+
+	PFStream* st = &pf_streams[best];
+	int dir = (d > 0) ? 1 : -1;
+	if (dir == st->dir)
+		st->confidence++;
+	else {
+		st->dir = dir;
+		st->confidence = 0;
+	}
+	st->line = line;
+	st->used = pf_clock;
+	if (st->confidence >= 1)
+		prefetch_lines(line, dir);
+}
+
+void pf_stride(Addr a, Addr pc)
+{
+	Addr key = pc ? pc : ~(a >> 12);
+	PFStride* e = &pf_strides[(key ^ (key >> 8)) & (PF_STRIDES-1)];
+	long long stride;
+	Addr target;
+	int i;
+
+	if (e->pc != key) {
+		e->pc = key;
+		e->last = a;
+		e->stride = 0;
+		e->confidence = 0;
+		return;
+	}
+	stride = (long long)(a - e->last);
+	e->last = a;
+	if (stride == 0)
+		return;
+	if (stride != e->stride) {
+		e->stride = stride;
+		e->confidence = 0;
+		return;
+	}
+	if (e->confidence < 3)
+		e->confidence++;
+	if (e->confidence < 2)
+		return;
+
+	// strides below a line size are prefetched as whole lines
+	for (i = 0; i < prefetch_degree; i++) {
+		if (stride > -LINESIZE && stride < LINESIZE)
+			target = a + (stride > 0 ? 1 : -1) * (prefetch_distance + i) * LINESIZE;
+		else
+			target = a + stride * (prefetch_distance + i);
+		cache_prefetch(target / LINESIZE);
+	}
+}
+
+// called for each demand access after the cache lookup
+void prefetch_access(Addr a, int size, int hit, Addr pc)
+{
+	Addr line = a / LINESIZE;
+
+	pf_clock++;
+	switch (prefetcher) {
+	case PF_NEXTLINE:
+		// on miss, and on first use of a prefetched line (tagged)
+		if (!hit || pf_tagged)
+			prefetch_lines((a + size - 1) / LINESIZE, 1);
+		break;
+	case PF_STREAM:
+		pf_stream(line, !hit || pf_tagged);
+		break;
+	case PF_STRIDE:
+		pf_stride(a, pc);
+		break;
+	default:
+		break;
+	}
+	pf_tagged = 0;
+}
+
+void print_prefetch()
+{
+	static const char* names[] = { "none", "next-line", "stream", "stride" };
+
+	if (prefetcher == PF_NONE)
+		return;
+	printf("\nPrefetcher %s (degree %d, distance %d):\n",
+		names[prefetcher], prefetch_degree, prefetch_distance);
+	printf("  issued %u, useful %u (late %u), useless %u, pollution misses %u\n",
+		pf_issued, pf_useful, pf_late, pf_useless, pf_pollution);
+}
+
+/* ----------------------------------------------------------------*/
+
+/*
+ * TLB simulation: L1 DTLB and second level STLB, both set-associative
+ * with LRU replacement and holding entries for all page sizes.
+ * STLB misses trigger a page walk on x86-64 style 4-level page tables,
+ * shortened by page walk caches for the upper levels (PML4E, PDPTE,
+ * PDE). Page table entries are placed into a synthetic address range,
+ * and their references optionally are injected into the data cache.
+ *
+ * The page size of registered data ranges can be set with
+ * SIMPLESIM_CONFIGURE("pagesize", bytes) before SIMPLESIM_DEFINE_DATA.
+ * Everything else uses 4 KiB pages.
+ *
+ * TLB misses are reported per 1000 data accesses. Instructions are not
+ * counted in the trace, so misses per 1000 instructions (MPKI) are not
+ * available.
+ */
+
+#define PAGE_4K (1ULL << 12)
+#define PAGE_2M (1ULL << 21)
+#define PAGE_1G (1ULL << 30)
+
+#define PT_BASE  0xffff800000000000ULL   // synthetic page tables
+#define PWC_ENTRIES 32
+
+typedef struct _tlb {
+	int entries;
+	int ways;
+	Addr* tag;          // per set, MRU first; 0 is invalid
+	unsigned long long hits, misses;
+} TLB;
+
+Addr pagesize = PAGE_4K;     // for data ranges defined next
+int tlb_walk_inject = FALSE; // page walk references go to the cache
+
+TLB dtlb = { 64, 4, NULL, 0, 0 };
+TLB stlb = { 1536, 12, NULL, 0, 0 };
+TLB pwc[3] = {               // page walk caches: PML4E, PDPTE, PDE
+	{ PWC_ENTRIES, PWC_ENTRIES, NULL, 0, 0 },
+	{ PWC_ENTRIES, PWC_ENTRIES, NULL, 0, 0 },
+	{ PWC_ENTRIES, PWC_ENTRIES, NULL, 0, 0 } };
+
+unsigned long long tlb_accesses = 0;
+unsigned long long tlb_pages[3];   // accesses by page size: 4K, 2M, 1G
+unsigned long long walk_refs = 0, walk_ref_misses = 0;
+int in_walk = FALSE;
+
+void tlb_init(TLB* t)
+{
+	free(t->tag);
+	if (t->ways > t->entries) t->ways = t->entries;
+	t->tag = calloc(t->entries, sizeof(Addr));
+	t->hits = 0;
+	t->misses = 0;
+}
+
+void tlb_clear()
+{
+	int i;
+	tlb_init(&dtlb);
+	tlb_init(&stlb);
+	for (i = 0; i < 3; i++)
+		tlb_init(&pwc[i]);
+}
+
+// look up <key> (never 0), insert on miss. Return 1 on hit
+int tlb_lookup(TLB* t, Addr key)
+{
+	int sets = t->entries / t->ways;
+	Addr* set = t->tag + (key % sets) * t->ways;
+	int i, j;
+
+	for (i = 0; i < t->ways; i++) {
+		if (set[i] == key) {
+			for (j = i; j > 0; j--)
+				set[j] = set[j - 1];
+			set[0] = key;
+			if (measuring)
+				t->hits++;
+			return 1;
+		}
+	}
+	for (j = t->ways - 1; j > 0; j--)
+		set[j] = set[j - 1];
+	set[0] = key;
+	if (measuring)
+		t->misses++;
+	return 0;
+}
+
+Addr page_size_of(Addr a)
+{
+	DataNode* nextData = dataList.first;
+	while (nextData != NULL) {
+		if (nextData->data->pagesize != PAGE_4K &&
+		    a >= nextData->data->start && a <= nextData->data->end)
+			return nextData->data->pagesize;
+		nextData = nextData->next;
+	}
+	return PAGE_4K;
+}
+
+// reference to the page table entry of level <level> (0: PML4E .. 3: PTE)
+void walk_ref(int level, Addr a)
+{
+	static const int shift[4] = { 39, 30, 21, 12 };
+	Addr entry = PT_BASE + ((Addr)level << 40) + (a >> shift[level]) * 8;
+
+	if (measuring)
+		walk_refs++;
+	if (!tlb_walk_inject) return;
+	in_walk = TRUE;
+	if (!cache_ref(entry, 8, FALSE) && measuring)
+		walk_ref_misses++;
+	in_walk = FALSE;
+}
+
+// page walk for address <a>, leaf level depends on page size
+void page_walk(Addr a, Addr psize)
+{
+	int leaf = (psize == PAGE_1G) ? 1 : (psize == PAGE_2M) ? 2 : 3;
+	int level, start = 0;
+
+	// find deepest upper level entry in page walk caches.
+	// Missing entries are inserted by the lookup
+	for (level = leaf - 1; level >= 0; level--) {
+		// key: address bits covered by an entry of level <level>
+		Addr key = ((a >> (39 - 9 * level)) << 2) | 1;
+		if (tlb_lookup(&pwc[level], key)) {
+			start = level + 1;
+			break;
+		}
+	}
+
+	for (level = start; level <= leaf; level++)
+		walk_ref(level, a);
+}
+
+void tlb_translate(Addr a, Addr psize)
+{
+	// tag: page number and page size class
+	int sclass = (psize == PAGE_1G) ? 2 : (psize == PAGE_2M) ? 1 : 0;
+	Addr key = ((a / psize) << 2) | (sclass + 1);
+
+	if (measuring)
+		tlb_pages[sclass]++;
+	if (tlb_lookup(&dtlb, key)) return;
+	if (tlb_lookup(&stlb, key)) return;
+	page_walk(a, psize);
+}
+
+void tlb_access(Addr a, int size)
+{
+	Addr last = a + size - 1;
+	Addr psize, psize2;
+
+	if (in_walk) return;
+	if (dtlb.tag == NULL) tlb_clear();
+
+	if (measuring)
+		tlb_accesses++;
+	psize = page_size_of(a);
+	tlb_translate(a, psize);
+
+	// access crossing a 4K boundary may touch further pages,
+	// large ones (TR_DATA_RANGE) many
+	while (last / PAGE_4K != a / PAGE_4K) {
+		a = (a / PAGE_4K + 1) * PAGE_4K;
+		psize2 = page_size_of(a);
+		if (psize2 != psize || a / psize2 != (a - 1) / psize2)
+			tlb_translate(a, psize2);
+		psize = psize2;
+	}
+}
+
+void print_tlb()
+{
+	int i;
+	static const char* level[3] = { "PML4E", "PDPTE", "PDE" };
+
+	if (!tlb_enabled || tlb_accesses == 0)
+		return;
+	printf("\nTLB (DTLB %d entries %d-way, STLB %d entries %d-way):\n",
+		dtlb.entries, dtlb.ways, stlb.entries, stlb.ways);
+	printf("  translations %llu (4K %llu, 2M %llu, 1G %llu)\n",
+		dtlb.hits + dtlb.misses, tlb_pages[0], tlb_pages[1], tlb_pages[2]);
+	printf("  DTLB misses %llu, STLB misses %llu (per 1000 data accesses: %.3f, %.3f)\n",
+		dtlb.misses, stlb.misses,
+		1000.0 * dtlb.misses / tlb_accesses, 1000.0 * stlb.misses / tlb_accesses);
+	printf("  page walk cache hit rates:");
+	for (i = 0; i < 3; i++) {
+		unsigned long long n = pwc[i].hits + pwc[i].misses;
+		printf(" %s %.1f%%", level[i], n ? 100.0 * pwc[i].hits / n : 0.0);
+	}
+	printf("\n  page walk references %llu", walk_refs);
+	if (tlb_walk_inject)
+		printf(", cache misses %llu", walk_ref_misses);
+	printf("\n");
+}
+
+/* ----------------------------------------------------------------*/
+
+/*
+ * Data layout what-if.
+ *
+ * Layout transforms are declared for the data range defined last,
+ * with SIMPLESIM_CONFIGURE settings (all in bytes):
+ *  layout_row/layout_pad:     add <pad> bytes after each row of <row>
+ *  layout_elem/layout_field:  array of structs with elements of <elem>
+ *                             bytes becomes struct of arrays, with
+ *                             fields of <field> bytes (default 8)
+ *  layout_align/layout_offset: range starts at next multiple of <align>,
+ *                             plus <offset>
+ * Two plain LRU caches of the same geometry are simulated side by side:
+ * one with original addresses, one with accesses to transformed ranges
+ * remapped. Both see demand accesses only (no prefetching). The
+ * transformed range is found in the ranges overlapping the access
+ * collected by cache_ref(), and remapping is a few divisions.
+ * Other data is not moved, even if a transformed range grows into it.
+ */
+
+typedef struct _layout {
+	Addr row, pad;
+	Addr elem, field, count;
+	Addr align, offset, base;
+	unsigned long long accesses, misses[2];
+} Layout;
+
+Addr* whatif_tags[2] = { NULL, NULL };  // line+1 per way, 0 if invalid
+unsigned long long whatif_accesses = 0, whatif_misses[2] = { 0, 0 };
+int layouts = 0;
+
+void whatif_clear()
+{
+	int c;
+
+	if(layouts==0)
+		return;
+	for(c=0;c<2;c++)
+	{
+		free(whatif_tags[c]);
+		whatif_tags[c] = calloc(cachelines, sizeof(Addr));
+	}
+}
+
+Layout* layout_get(Data* d)
+{
+	if(d->layout==NULL)
+	{
+		d->layout = calloc(1, sizeof(Layout));
+		d->layout->base = d->start;
+		if(layouts++ == 0)
+			whatif_clear();
+	}
+	return d->layout;
+}
+
+// apply setting to last defined data range, return FALSE if unknown
+int layout_configure(const char* setting, int value)
+{
+	Layout* l;
+	Data* d;
+
+	if(strncmp(setting, "layout_", 7) != 0)
+		return FALSE;
+	if(dataList.last==NULL)
+	{
+		printf("Warning: %s without data range ignored\n", setting);
+		return TRUE;
+	}
+	d = dataList.last->data;
+	l = layout_get(d);
+	if(strcmp(setting, "layout_row") == 0)
+		l->row = value;
+	else if(strcmp(setting, "layout_pad") == 0)
+		l->pad = value;
+	else if(strcmp(setting, "layout_elem") == 0)
+		l->elem = value;
+	else if(strcmp(setting, "layout_field") == 0)
+		l->field = value;
+	else if(strcmp(setting, "layout_align") == 0)
+		l->align = value;
+	else if(strcmp(setting, "layout_offset") == 0)
+		l->offset = value;
+	else
+		printf("Warning: unknown setting %s ignored\n", setting);
+
+	if(l->elem)
+	{
+		if(l->field==0)
+			l->field = (l->elem < 8) ? l->elem : 8;
+		if(l->elem % l->field)
+		{
+			printf("Warning: %s: element size %llu not a multiple of field size %llu\n",
+				d->section->description, l->elem, l->field);
+			l->elem = 0;
+		}
+		else
+			l->count = (d->end - d->start) / l->elem;
+	}
+	l->base = d->start;
+	if(l->align)
+		l->base = (d->start + l->align - 1) / l->align * l->align;
+	l->base += l->offset;
+	return TRUE;
+}
+
+// address of <a> (within <d>) in the transformed layout
+static inline Addr layout_remap(Data* d, Addr a)
+{
+	Layout* l = d->layout;
+	Addr o = a - d->start;
+
+	if(l->elem)
+	{
+		Addr i = o / l->elem, f = o % l->elem;
+		o = (f / l->field) * (l->count * l->field) + i * l->field + f % l->field;
+	}
+	if(l->row)
+		o += (o / l->row) * l->pad;
+	return l->base + o;
+}
+
+// reference to what-if cache <c>, return 1 on hit
+int whatif_ref(int c, Addr a, int size, int write)
+{
+	Addr line, last = (a + size - 1) / LINESIZE;
+	Addr* set;
+	int hit = 1, w;
+
+	for(line = a / LINESIZE; line <= last; line++)
+	{
+		set = whatif_tags[c] + line_set(line) * setsize;
+		for(w=0; w<setsize; w++)
+			if(set[w] == line+1)
+				break;
+		if(w == setsize)
+		{
+			hit = 0;
+			if(write && !write_allocate)
+				continue;
+			w = setsize-1;
+		}
+		// move to front (LRU)
+		for(; w>0; w--)
+			set[w] = set[w-1];
+		set[0] = line+1;
+	}
+	return hit;
+}
+
+// called after cache_ref() for the same access
+void whatif_access(Addr a, int size, int write)
+{
+	Data* d = NULL;
+	Addr p, end = a + size;
+	int hit0, hit1, n, r;
+
+	for(r=0; r<noverlap; r++)
+		if(overlap[r]->layout && a>=overlap[r]->start && a<overlap[r]->end)
+		{
+			d = overlap[r];
+			break;
+		}
+	hit0 = whatif_ref(0, a, size, write);
+	if(d)
+	{
+		// remap fragments within one original line by their first byte
+		hit1 = 1;
+		for(p=a; p<end; p+=n)
+		{
+			n = LINESIZE - (p & (LINESIZE-1));
+			if((Addr)n > end-p)
+				n = end-p;
+			hit1 &= whatif_ref(1, (p < d->end) ? layout_remap(d, p) : p, n, write);
+		}
+	}
+	else
+		hit1 = whatif_ref(1, a, size, write);
+
+	if(!measuring)
+		return;
+	whatif_accesses++;
+	whatif_misses[0] += !hit0;
+	whatif_misses[1] += !hit1;
+	if(d)
+	{
+		d->layout->accesses++;
+		d->layout->misses[0] += !hit0;
+		d->layout->misses[1] += !hit1;
+	}
+}
+
+static void print_layout_line(const char* name, unsigned long long accesses,
+			      unsigned long long m0, unsigned long long m1)
+{
+	printf("  %-20s %12llu %12llu %12llu", name, accesses, m0, m1);
+	if(m0)
+		printf("  %+6.1f%%", 100.0 * ((double)m1 - (double)m0) / m0);
+	printf("\n");
+}
+
+void print_layout()
+{
+	DataNode* next;
+	Layout* l;
+
+	if(layouts==0)
+		return;
+	printf("\nLayout what-if (%d ranges transformed, LRU without prefetching):\n", layouts);
+	for(next=dataList.first; next!=NULL; next=next->next)
+	{
+		l = next->data->layout;
+		if(l==NULL)
+			continue;
+		printf("  %s:", next->data->section->description);
+		if(l->row)
+			printf(" rows of %llu padded by %llu,", l->row, l->pad);
+		if(l->elem)
+			printf(" struct of arrays (%llu fields of %llu),", l->elem / l->field, l->field);
+		printf(" at %#llx (was %#llx)\n", l->base, next->data->start);
+	}
+	printf("  %-20s %12s %12s %12s  %s\n", "range", "accesses", "misses", "transformed", "change");
+	for(next=dataList.first; next!=NULL; next=next->next)
+	{
+		l = next->data->layout;
+		if(l)
+			print_layout_line(next->data->section->description,
+					  l->accesses, l->misses[0], l->misses[1]);
+	}
+	print_layout_line("total", whatif_accesses, whatif_misses[0], whatif_misses[1]);
+}
+
+/* ----------------------------------------------------------------*/
+
+/*
+ * Way partitioning, as with Intel Cache Allocation Technology (CAT).
+ *
+ * Each access belongs to a class. On a miss, only lines in the ways
+ * of the class mask may be replaced, but hits are possible in all
+ * ways. Configured with SIMPLESIM_CONFIGURE settings:
+ *  cat_mask:<class>   bit mask of allowed ways (default: all ways)
+ *  cat_thread:<tid>   class of accesses by thread <tid>
+ *  cat_section:<id>   class of accesses in section <id>
+ *  cat_data           class of accesses to the data range defined last
+ * A data range class takes precedence over the section class, and the
+ * section class over the thread class. Otherwise the class is 0.
+ * The first such setting enables partitioning. Lines filled before
+ * that are not attributed to any class.
+ */
+
+#define CAT_CLASSES   16
+#define CAT_THREADS   256
+#define CAT_SECTIONS  256   // section ids with assigned class
+
+typedef struct _catclass {
+	unsigned int mask;               // as configured, 0: all ways
+	unsigned long long accesses, misses;
+	unsigned int lines;              // lines filled by this class
+	unsigned long long lines_sum;    // lines summed over accesses
+	unsigned long long lines_since;  // cat_clock at last update of sum
+} CatClass;
+
+CatClass cat_classes[CAT_CLASSES];
+signed char cat_thread_class[CAT_THREADS];
+struct { int id, cls; } cat_sections[CAT_SECTIONS];
+int cat_sections_used = 0;
+int cat_tid = 0;               // current thread
+int cat_current = 0;           // class of current access
+signed char* cat_owner = NULL; // class which filled way, per set and way
+unsigned long long cat_clock = 0;  // accesses counted
+
+// class assigned to section <id> (also before it exists), or -1
+int cat_section_class(int id)
+{
+	int i;
+	for(i=0; i<cat_sections_used; i++)
+		if(cat_sections[i].id == id)
+			return cat_sections[i].cls;
+	return -1;
+}
+
+static void cat_lines(int c, int delta)
+{
+	CatClass* k = &cat_classes[c];
+
+	k->lines_sum += (unsigned long long)k->lines * (cat_clock - k->lines_since);
+	k->lines_since = cat_clock;
+	k->lines += delta;
+}
+
+// way <way> in set <set_no> was filled by current access
+void cat_fill(int set_no, int way)
+{
+	int i = set_no * setsize + way;
+
+	if(cat_owner[i] >= 0)
+		cat_lines(cat_owner[i], -1);
+	cat_owner[i] = cat_current;
+	cat_lines(cat_current, 1);
+}
+
+// cache contents were dropped
+void cat_clear()
+{
+	int c;
+
+	if(!cat_enabled)
+		return;
+	free(cat_owner);
+	cat_owner = malloc(cachelines);
+	memset(cat_owner, -1, cachelines);
+	for(c=0; c<CAT_CLASSES; c++)
+		cat_lines(c, -(int)cat_classes[c].lines);
+}
+
+// set class and way mask for access at <a>
+void cat_select(Addr a)
+{
+	int c = (cat_tid < CAT_THREADS) ? cat_thread_class[cat_tid] : -1;
+	unsigned int all = (setsize >= 32) ? ~0u : (1u << setsize) - 1;
+	int r;
+
+	if(currentSection->cat_class >= 0)
+		c = currentSection->cat_class;
+	for(r=0; r<noverlap; r++)
+		if(overlap[r]->section->cat_class >= 0 &&
+		   a>=overlap[r]->start && a<overlap[r]->end)
+		{
+			c = overlap[r]->section->cat_class;
+			break;
+		}
+	if(c < 0)
+		c = 0;
+	cat_current = c;
+	cat_mask = cat_classes[c].mask & all;
+	if(cat_mask == 0)
+		cat_mask = all;
+}
+
+// apply setting, return FALSE if not a partitioning setting
+int cat_configure(const char* setting, int value)
+{
+	SectionNode* node;
+	int n, i;
+
+	if(strncmp(setting, "cat_", 4) != 0)
+		return FALSE;
+	if(setsize > 32)
+	{
+		printf("Warning: way partitioning needs at most 32 ways, %s ignored\n", setting);
+		return TRUE;
+	}
+	if(!cat_enabled)
+	{
+		cat_enabled = TRUE;
+		memset(cat_thread_class, -1, sizeof(cat_thread_class));
+		cat_clear();
+	}
+
+	if(sscanf(setting, "cat_mask:%d", &n) == 1)
+	{
+		if(n >= 0 && n < CAT_CLASSES)
+			cat_classes[n].mask = value;
+		return TRUE;
+	}
+	if(value < 0 || value >= CAT_CLASSES)
+	{
+		printf("Warning: %s: no class %d (0..%d), ignored\n", setting, value, CAT_CLASSES-1);
+		return TRUE;
+	}
+	if(sscanf(setting, "cat_thread:%d", &n) == 1)
+	{
+		if(n >= 0 && n < CAT_THREADS)
+			cat_thread_class[n] = value;
+	}
+	else if(sscanf(setting, "cat_section:%d", &n) == 1)
+	{
+		for(i=0; i<cat_sections_used; i++)
+			if(cat_sections[i].id == n)
+				break;
+		if(i == CAT_SECTIONS)
+		{
+			printf("Warning: too many sections with class, %s ignored\n", setting);
+			return TRUE;
+		}
+		if(i == cat_sections_used)
+			cat_sections_used++;
+		cat_sections[i].id = n;
+		cat_sections[i].cls = value;
+		for(node=sections.first; node!=NULL; node=node->next)
+			if(node->section->id == n)
+				node->section->cat_class = value;
+	}
+	else if(strcmp(setting, "cat_data") == 0)
+	{
+		if(dataList.last)
+			dataList.last->data->section->cat_class = value;
+		else
+			printf("Warning: %s without data range ignored\n", setting);
+	}
+	else
+		printf("Warning: unknown setting %s ignored\n", setting);
+	return TRUE;
+}
+
+void cat_access(int hit)
+{
+	cat_clock++;
+	cat_classes[cat_current].accesses++;
+	if(!hit)
+		cat_classes[cat_current].misses++;
+}
+
+void print_cat()
+{
+	unsigned int all = (setsize >= 32) ? ~0u : (1u << setsize) - 1;
+	unsigned int mask;
+	CatClass* k;
+	int c;
+
+	if(!cat_enabled)
+		return;
+	printf("\nWay partitioning (%d ways, %d sets):\n", setsize, cache_sets);
+	printf("  class %10s %12s %12s %8s %8s %10s\n",
+		"ways", "accesses", "misses", "ratio", "lines", "avg lines");
+	for(c=0; c<CAT_CLASSES; c++)
+	{
+		k = &cat_classes[c];
+		cat_lines(c, 0);
+		if(k->mask == 0 && k->accesses == 0 && k->lines == 0)
+			continue;
+		mask = (k->mask & all) ? (k->mask & all) : all;
+		printf("  %5d %#10x %12llu %12llu %7.2f%% %8u %10.1f\n", c, mask,
+			k->accesses, k->misses,
+			k->accesses ? 100.0 * k->misses / k->accesses : 0.0,
+			k->lines, cat_clock ? (double)k->lines_sum / cat_clock : 0.0);
+	}
+}
+
+/* ----------------------------------------------------------------*/
+
+/*
+ * Timing model: first-order estimate of where time goes.
+ * Each access costs the hit latency of the cache. Lines missed add the
+ * latency of the victim/miss buffer if served there, else the memory
+ * latency divided by the memory-level parallelism (MLP, in percent:
+ * 200 means two misses overlap on average). With TLB simulation, STLB
+ * hits and page walks add their latency. Stall cycles are the cycles
+ * beyond the hit latency. Enabled by "timing" or any latency setting.
+ */
+
+int timing = FALSE;
+int lat_hit = 4, lat_buffer = 10, lat_mem = 200;
+int lat_stlb = 7, lat_walk = 30;
+int mlp = 100;
+
+typedef struct _threadtime {
+	unsigned long long accesses;
+	double cycles, stall;
+} ThreadTime;
+
+ThreadTime* thread_time = NULL;
+int thread_time_size = 0;
+
+// cycles of an access that missed <lines> lines (<served> of them in
+// the buffer), with <dtlb_misses> and <stlb_misses>
+double access_cycles(unsigned long long lines, unsigned long long served,
+	unsigned long long dtlb_misses, unsigned long long stlb_misses)
+{
+	return lat_hit + served * lat_buffer +
+		(lines - served) * (double)lat_mem * 100 / mlp +
+		(dtlb_misses - stlb_misses) * lat_stlb + stlb_misses * lat_walk;
+}
+
+void thread_time_access(int t, double cycles)
+{
+	if (t >= thread_time_size) {
+		int size = thread_time_size ? thread_time_size : 16;
+		while (size <= t)
+			size *= 2;
+		thread_time = realloc(thread_time, size * sizeof(ThreadTime));
+		memset(thread_time + thread_time_size, 0,
+			(size - thread_time_size) * sizeof(ThreadTime));
+		thread_time_size = size;
+	}
+	thread_time[t].accesses++;
+	thread_time[t].cycles += cycles;
+	thread_time[t].stall += cycles - lat_hit;
+}
+
+// apply setting, return FALSE if not a timing setting
+int timing_configure(const char* setting, int value)
+{
+	if(strcmp(setting, "timing") == 0)
+	{
+		timing = value;
+		return TRUE;
+	}
+	if(strcmp(setting, "lat_hit") == 0)
+		lat_hit = value;
+	else if(strcmp(setting, "lat_buffer") == 0)
+		lat_buffer = value;
+	else if(strcmp(setting, "lat_mem") == 0)
+		lat_mem = value;
+	else if(strcmp(setting, "lat_stlb") == 0)
+		lat_stlb = value;
+	else if(strcmp(setting, "lat_walk") == 0)
+		lat_walk = value;
+	else if(strcmp(setting, "mlp") == 0)
+		mlp = (value > 0) ? value : 100;
+	else
+		return FALSE;
+	timing = TRUE;
+	return TRUE;
+}
+
+void print_time_line(const char* name, unsigned long long accesses,
+	double cycles, double stall, double total_stall)
+{
+	printf("  %-20s AMAT %7.2f, cycles %14.0f, stall %14.0f (%5.1f%%)\n",
+		name, cycles / accesses, cycles, stall,
+		total_stall > 0 ? 100.0 * stall / total_stall : 0.0);
+}
+
+void print_timing()
+{
+	SectionNode* next;
+	SectionStat* st;
+	unsigned long long accesses = 0;
+	double cycles = 0, stall = 0;
+	char name[32];
+	int t;
+
+	if(!timing)
+		return;
+	for(t=0; t<thread_time_size; t++)
+	{
+		accesses += thread_time[t].accesses;
+		cycles += thread_time[t].cycles;
+		stall += thread_time[t].stall;
+	}
+	if(accesses == 0)
+		return;
+	printf("\nTiming model (latency hit %d, buffer %d, memory %d, MLP %.2f",
+		lat_hit, lat_buffer, lat_mem, mlp / 100.0);
+	if(tlb_enabled)
+		printf(", STLB %d, walk %d", lat_stlb, lat_walk);
+	printf("):\n");
+	print_time_line("total", accesses, cycles, stall, stall);
+	for(next=sections.first; next!=NULL; next=next->next)
+	{
+		st=&section_stats[next->section->index];
+		if(st->loads + st->stores == 0)
+			continue;
+		print_time_line(next->section->description, st->loads + st->stores,
+			st->cycles, st->stall, stall);
+	}
+	for(t=0; t<thread_time_size; t++)
+	{
+		if(thread_time[t].accesses == 0)
+			continue;
+		sprintf(name, "thread %d", t);
+		print_time_line(name, thread_time[t].accesses,
+			thread_time[t].cycles, thread_time[t].stall, stall);
+	}
+}
+
+/* ----------------------------------------------------------------*/
+
+/* global counters for cache simulation */
+int loads = 0, stores = 0, lmisses = 0, smisses = 0;
+
+// count access at <a> for active section and data ranges containing <a>
+void section_stat(Section* section, int write, int hit, unsigned int evicted,
+	double cycles)
+{
+	SectionStat* st = &section_stats[section->index];
+
+	if (write) {
+		st->stores++;
+		if (!hit) st->smisses++;
+	}
+	else {
+		st->loads++;
+		if (!hit) st->lmisses++;
+	}
+	st->evictions += evicted;
+	if (timing) {
+		st->cycles += cycles;
+		st->stall += cycles - lat_hit;
+	}
+}
+
+void section_stat_access(Addr a, int write, int hit, unsigned int evicted,
+	double cycles)
+{
+	DataNode* nextData;
+
+	section_stat(currentSection, write, hit, evicted, cycles);
+	for(nextData=dataList.first; nextData!=NULL; nextData=nextData->next)
+		if(a>=nextData->data->start && a<=nextData->data->end)
+			section_stat(nextData->data->section, write, hit, evicted, cycles);
+}
+
+void print_section_stats()
+{
+	SectionNode* next;
+	SectionStat* st;
+
+	if(!section_report)
+		return;
+	printf("\nSection accesses (loads / stores, miss ratio, evictions caused):\n");
+	for(next=sections.first; next!=NULL; next=next->next)
+	{
+		st=&section_stats[next->section->index];
+		if(st->loads + st->stores == 0)
+			continue;
+		printf("  %-20s L %10llu (%5.2f%% miss), S %10llu (%5.2f%% miss), total %5.2f%%, ev %llu\n",
+			next->section->description,
+			st->loads, st->loads ? 100.0 * st->lmisses / st->loads : 0.0,
+			st->stores, st->stores ? 100.0 * st->smisses / st->stores : 0.0,
+			100.0 * (st->lmisses + st->smisses) / (st->loads + st->stores),
+			st->evictions);
+	}
+}
+
+/* thread executing next memory accesses */
+int tid = 0;
+
+/* instruction doing next memory access, 0 if unknown (needs --pc=yes) */
+Addr pc = 0;
+
+/* client executable, for reports */
+char exe_path[240] = "";
+
+/* number of instructions to print in miss attribution report */
+int pc_top = 20;
+
+/* Burst sampling (McTracer --sample-on/--sample-off):
+ * the first <sample_warmup> accesses of each traced interval only
+ * warm up the cache and are not counted */
+int sample_warmup = 0;
+int warmup_left = 0;
+unsigned int sample_intervals = 0;
+unsigned long long sample_skipped = 0, sample_warmed = 0;
+
+/* ----------------------------------------------------------------*/
+
+/*
+ * Per-instruction hit/miss counters.
+ * Open addressing hash table with linear probing, keyed by
+ * instruction address. Grows when half full.
+ */
+
+typedef struct _pcstat {
+	Addr pc;             // 0: empty slot
+	unsigned int loads, stores, lmisses, smisses;
+} PCStat;
+
+PCStat* pcstats = NULL;
+unsigned int pcstats_size = 0;   // power of 2
+unsigned int pcstats_used = 0;
+
+static inline unsigned int pc_hash(Addr a)
+{
+	return (unsigned int)((a * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+PCStat* pcstat_get(Addr a);
+
+void pcstats_resize(unsigned int size)
+{
+	PCStat* old = pcstats;
+	unsigned int old_size = pcstats_size;
+	unsigned int i;
+
+	pcstats = calloc(size, sizeof(PCStat));
+	pcstats_size = size;
+	pcstats_used = 0;
+	for(i=0;i<old_size;++i)
+	{
+		if(old[i].pc!=0)
+			*pcstat_get(old[i].pc) = old[i];
+	}
+	free(old);
+}
+
+PCStat* pcstat_get(Addr a)
+{
+	unsigned int i;
+
+	if(2*(pcstats_used+1) > pcstats_size)
+		pcstats_resize(pcstats_size ? 2*pcstats_size : 4096);
+
+	i = pc_hash(a) & (pcstats_size-1);
+	while(pcstats[i].pc!=a)
+	{
+		if(pcstats[i].pc==0)
+		{
+			pcstats[i].pc=a;
+			pcstats_used++;
+			break;
+		}
+		i = (i+1) & (pcstats_size-1);
+	}
+	return &pcstats[i];
+}
+
+int pcstat_cmp(const void* a, const void* b)
+{
+	const PCStat* pa = a;
+	const PCStat* pb = b;
+	unsigned int ma = pa->lmisses + pa->smisses;
+	unsigned int mb = pb->lmisses + pb->smisses;
+	return (ma < mb) - (ma > mb);
+}
+
+/* Code of loaded objects (TR_OBJ_INFO, sent at exit with --pc=yes),
+ * for symbolization of instruction addresses */
+typedef struct {
+	Addr avma, size, bias;
+	char* path;
+} Object;
+
+Object* objects = NULL;
+int objects_used = 0, objects_size = 0;
+
+void obj_info(ev_obj_info* e)
+{
+	if(objects_used == objects_size)
+	{
+		objects_size = objects_size ? 2*objects_size : 64;
+		objects = realloc(objects, objects_size * sizeof(Object));
+	}
+	objects[objects_used].avma = e->avma;
+	objects[objects_used].size = e->size;
+	objects[objects_used].bias = e->bias;
+	objects[objects_used].path = strdup(e->path);
+	objects_used++;
+}
+
+// run <argv> without shell, return stream reading its output
+FILE* run_reader(char** argv, pid_t* pid)
+{
+	int fd[2];
+
+	if(pipe(fd) < 0)
+		return NULL;
+	*pid = fork();
+	if(*pid < 0)
+	{
+		close(fd[0]);
+		close(fd[1]);
+		return NULL;
+	}
+	if(*pid == 0)
+	{
+		dup2(fd[1], 1);
+		close(fd[0]);
+		close(fd[1]);
+		execvp(argv[0], argv);
+		_exit(127);
+	}
+	close(fd[1]);
+	return fdopen(fd[0], "r");
+}
+
+/* Symbolize <n> instruction addresses with addr2line,
+ * writing "function (file:line)" into <names>, 256 bytes each.
+ * addr2line is run once per object containing some of the addresses,
+ * with their offsets in the object file, so this also works for
+ * position independent executables and shared libraries. Addresses
+ * in objects unloaded before exit stay empty.
+ * Only called for the top entries at exit. */
+void symbolize(Addr* pcs, int n, char (*names)[256])
+{
+	char fn[256], line[256];
+	char (*offsets)[20];
+	char** argv;
+	int* idx;
+	int i, j, m, o;
+	pid_t pid;
+	FILE* f;
+
+	for(i=0;i<n;++i)
+		names[i][0]='\0';
+
+	idx = malloc(n * sizeof(int) + 1);
+	offsets = malloc(n * sizeof(*offsets) + 1);
+	argv = malloc((n + 6) * sizeof(char*));
+	for(o=0;o<objects_used;++o)
+	{
+		Object* obj = &objects[o];
+
+		m = 0;
+		for(i=0;i<n;++i)
+			if(pcs[i] >= obj->avma && pcs[i] - obj->avma < obj->size)
+				idx[m++] = i;
+		if(m == 0)
+			continue;
+
+		argv[0] = "addr2line";
+		argv[1] = "-f";
+		argv[2] = "-C";
+		argv[3] = "-e";
+		argv[4] = obj->path;
+		for(j=0;j<m;++j)
+		{
+			sprintf(offsets[j], "%llx", pcs[idx[j]] - obj->bias);
+			argv[5+j] = offsets[j];
+		}
+		argv[5+m] = NULL;
+
+		f = run_reader(argv, &pid);
+		if(f == NULL)
+			continue;
+		for(j=0;j<m;++j)
+		{
+			if(!fgets(fn, sizeof(fn), f) || !fgets(line, sizeof(line), f))
+				break;
+			fn[strcspn(fn, "\n")]='\0';
+			line[strcspn(line, "\n")]='\0';
+			snprintf(names[idx[j]], 256, "%.160s (%.90s)", fn, line);
+		}
+		fclose(f);
+		waitpid(pid, NULL, 0);
+	}
+	free(argv);
+	free(offsets);
+	free(idx);
+}
+
+void print_pcstats()
+{
+	PCStat* top;
+	Addr* pcs;
+	char (*names)[256];
+	unsigned int i, n=0;
+
+	if(pcstats_used==0 || pc_top<=0)
+		return;
+
+	top = malloc(pcstats_used * sizeof(PCStat));
+	for(i=0;i<pcstats_size;++i)
+	{
+		if(pcstats[i].pc!=0)
+			top[n++]=pcstats[i];
+	}
+	qsort(top, n, sizeof(PCStat), pcstat_cmp);
+	if(n > (unsigned int)pc_top)
+		n = pc_top;
+	names = malloc(n * sizeof(*names));
+	pcs = malloc(n * sizeof(Addr));
+	for(i=0;i<n;++i)
+		pcs[i]=top[i].pc;
+	symbolize(pcs, n, names);
+	free(pcs);
+
+	printf("\nMisses by instruction (top %d of %d):\n", n, pcstats_used);
+	for(i=0;i<n;++i)
+	{
+		printf("%#14llx  loads %u / %u, stores %u / %u  %s\n",
+			top[i].pc, top[i].lmisses, top[i].loads,
+			top[i].smisses, top[i].stores, names[i]);
+	}
+	free(names);
+	free(top);
+}
+
+/* ----------------------------------------------------------------*/
+
+/*
+ * Access pattern classification per instruction (needs --pc=yes),
+ * enabled with SIMPLESIM_CONFIGURE("patterns", <entries>).
+ *
+ * A set-associative table keyed by instruction address tracks the
+ * address delta between consecutive accesses of each instruction:
+ * - repeated: same nonzero delta as the one before
+ * - near:     delta below a line size (same or adjacent line)
+ * - far:      any other delta
+ * At exit or when an entry is replaced, the instruction is classified:
+ * - streaming:       mostly near or repeated deltas below a line size
+ * - constant-stride: mostly one repeated delta of a line size or more
+ * - pointer-chasing: mostly far deltas of pointer-sized loads. Loaded
+ *                    values are not traced, so this is a guess: such
+ *                    loads without stride typically follow pointers
+ * - irregular:       everything else
+ * Replaced entries are added to the per-class totals, so memory stays
+ * fixed; only instructions still in the table can be listed.
+ */
+
+#define PATTERN_WAYS 4
+#define PATTERN_MIN_DELTAS 4   // fewer: not classified
+
+#define PAT_STREAM  0
+#define PAT_STRIDE  1
+#define PAT_POINTER 2
+#define PAT_IRREG   3
+#define PAT_FEW     4
+#define PAT_CLASSES 5
+
+typedef struct _pattern {
+	Addr pc;               // 0: free
+	Addr last;             // address of last access
+	long long stride;      // last delta
+	unsigned int accesses, misses;
+	unsigned int repeated, near, far;
+	unsigned int used;     // for LRU replacement
+	unsigned char size;    // largest access size
+	unsigned char stores;  // any store seen
+} Pattern;
+
+Pattern* patterns = NULL;
+unsigned int pattern_sets = 0;
+unsigned int pattern_clock = 0, pattern_replaced = 0;
+
+typedef struct _patternclass {
+	unsigned int pcs;
+	unsigned long long accesses, misses;
+} PatternClass;
+
+PatternClass pattern_classes[PAT_CLASSES];
+
+void pattern_configure(int entries)
+{
+	unsigned int sets = 1;
+
+	free(patterns);
+	patterns = NULL;
+	pattern_sets = 0;
+	if(entries <= 0)
+		return;
+	while(sets * 2 * PATTERN_WAYS <= (unsigned int) entries)
+		sets *= 2;
+	patterns = calloc(sets * PATTERN_WAYS, sizeof(Pattern));
+	pattern_sets = sets;
+	memset(pattern_classes, 0, sizeof(pattern_classes));
+	pattern_replaced = 0;
+}
+
+int pattern_class(Pattern* p)
+{
+	unsigned int deltas = p->repeated + p->near + p->far;
+
+	if(deltas < PATTERN_MIN_DELTAS)
+		return PAT_FEW;
+	if(4 * p->repeated >= 3 * deltas)
+		return (p->stride > -LINESIZE && p->stride < LINESIZE) ? PAT_STREAM : PAT_STRIDE;
+	if(4 * (p->repeated + p->near) >= 3 * deltas)
+		return PAT_STREAM;
+	if(2 * p->far >= deltas && !p->stores && p->size == sizeof(Addr))
+		return PAT_POINTER;
+	return PAT_IRREG;
+}
+
+// add entry to class totals
+void pattern_retire(Pattern* p)
+{
+	PatternClass* c = &pattern_classes[pattern_class(p)];
+
+	c->pcs++;
+	c->accesses += p->accesses;
+	c->misses += p->misses;
+}
+
+// called for each counted access with known instruction address
+void pattern_access(Addr a, int len, int write, int hit)
+{
+	Pattern* set = &patterns[(pc_hash(pc) & (pattern_sets-1)) * PATTERN_WAYS];
+	Pattern* p = NULL;
+	long long delta;
+	int w;
+
+	pattern_clock++;
+	for(w=0; w<PATTERN_WAYS; w++)
+		if(set[w].pc == pc)
+		{
+			p = &set[w];
+			break;
+		}
+	if(p == NULL)
+	{
+		// free or least recently used way
+		p = &set[0];
+		for(w=1; w<PATTERN_WAYS && p->pc != 0; w++)
+			if(set[w].pc == 0 || set[w].used < p->used)
+				p = &set[w];
+		if(p->pc != 0)
+		{
+			pattern_retire(p);
+			pattern_replaced++;
+		}
+		memset(p, 0, sizeof(Pattern));
+		p->pc = pc;
+	}
+	else
+	{
+		delta = (long long)(a - p->last);
+		if(delta != 0 && delta == p->stride)
+			p->repeated++;
+		else if(delta > -LINESIZE && delta < LINESIZE)
+			p->near++;
+		else
+			p->far++;
+		p->stride = delta;
+	}
+	p->last = a;
+	p->used = pattern_clock;
+	p->accesses++;
+	if(!hit)
+		p->misses++;
+	if(len > p->size)
+		p->size = len > 255 ? 255 : len;
+	if(write)
+		p->stores = 1;
+}
+
+int pattern_cmp(const void* a, const void* b)
+{
+	const Pattern* pa = a;
+	const Pattern* pb = b;
+	return (pa->misses < pb->misses) - (pa->misses > pb->misses);
+}
+
+void print_patterns()
+{
+	static const char* names[] = { "streaming", "constant-stride",
+		"pointer-chasing", "irregular", "(few accesses)" };
+	unsigned long long total = lmisses + smisses;
+	Pattern* top;
+	Addr* pcs;
+	char (*fn)[256];
+	unsigned int i, n = 0;
+	int c;
+
+	if(pattern_sets == 0)
+		return;
+	top = malloc(pattern_sets * PATTERN_WAYS * sizeof(Pattern));
+	for(i=0; i<pattern_sets * PATTERN_WAYS; i++)
+		if(patterns[i].pc != 0)
+		{
+			pattern_retire(&patterns[i]);
+			top[n++] = patterns[i];
+		}
+
+	printf("\nAccess patterns (%u entries, %u replaced):\n",
+		pattern_sets * PATTERN_WAYS, pattern_replaced);
+	for(c=0; c<PAT_CLASSES; c++)
+		printf("  %-16s %6u instr, accesses %10llu, misses %10llu (%5.1f%%)\n",
+			names[c], pattern_classes[c].pcs, pattern_classes[c].accesses,
+			pattern_classes[c].misses,
+			total ? 100.0 * pattern_classes[c].misses / total : 0.0);
+
+	qsort(top, n, sizeof(Pattern), pattern_cmp);
+	if(n > (unsigned int)pc_top)
+		n = pc_top;
+	while(n > 0 && top[n-1].misses == 0)
+		n--;
+	fn = malloc(n * sizeof(*fn) + 1);
+	pcs = malloc(n * sizeof(Addr) + 1);
+	for(i=0; i<n; i++)
+		pcs[i] = top[i].pc;
+	symbolize(pcs, n, fn);
+	for(i=0; i<n; i++)
+	{
+		c = pattern_class(&top[i]);
+		printf("%#14llx  %-15s", top[i].pc, names[c]);
+		if(c == PAT_STRIDE)
+			printf(" %6lld", top[i].stride);
+		else
+			printf("       ");
+		printf("  misses %8u / %8u (%5.1f%%)  %s\n",
+			top[i].misses, top[i].accesses,
+			total ? 100.0 * top[i].misses / total : 0.0, fn[i]);
+	}
+	free(pcs);
+	free(fn);
+	free(top);
+}
+
+
+void sections_thread(int t);
+void calls_thread(int t);
+
+void run_tid(ev_run_tid* e)
+{  
+  // not really needed here: we assume a shared cache for all threads
+  tid = e->tid;
+  cat_tid = tid;
+  sections_thread(tid);
+  calls_thread(tid);
+}
+
+void sample(ev_sample* e)
+{
+  sample_skipped += e->skipped;
+  if (e->traced) {
+    sample_intervals++;
+    warmup_left = sample_warmup;
+  }
+}
+
+void mem_access(Addr addr, int len, int write)
+{
+  int res;
+  unsigned long long ev = evictions, lm = misses, vh = vbuf_hits;
+  unsigned long long dm = dtlb.misses, sm = stlb.misses;
+  double cycles = 0;
+  // warm-up accesses only update simulator state, no statistics
+  measuring = warmup_left == 0;
+  res = cache_ref(addr, len, write);
+  if (layouts)
+    whatif_access(addr, len, write);
+  if (prefetcher != PF_NONE)
+    prefetch_access(addr, len, res, pc);
+  if (!measuring) {
+    measuring = TRUE;
+    warmup_left--;
+    sample_warmed++;
+    return;
+  }
+  // printf(" > %s by T%d at %p, size %2d: %s\n", write ? "Store" : "Load ",
+  //	 tid, (void*) addr, len, res ? "Hit ":"Miss");
+  if (timing) {
+    cycles = access_cycles(misses - lm, vbuf_hits - vh,
+                           dtlb.misses - dm, stlb.misses - sm);
+    thread_time_access(tid, cycles);
+  }
+  section_stat_access(addr, write, res, evictions - ev, cycles);
+  if (cat_enabled)
+    cat_access(res);
+  if (write) {
+    stores++;
+    if (res == 0) smisses++;
+  }
+  else {
+    loads++;
+    if (res == 0) lmisses++;
+  }
+  if (pc && pattern_sets)
+    pattern_access(addr, len, write, res);
+  if (pc) {
+    PCStat* ps = pcstat_get(pc);
+    if (write) {
+      ps->stores++;
+      if (res == 0) ps->smisses++;
+    }
+    else {
+      ps->loads++;
+      if (res == 0) ps->lmisses++;
+    }
+  }
+}
+
+void data_read(ev_data_read* e)
+{
+  mem_access(e->addr, e->len, FALSE);
+}
+
+void data_write(ev_data_write* e)
+{
+  mem_access(e->addr, e->len, TRUE);
+}
+
+// access too large for TR_DATA_READ/TR_DATA_WRITE
+void data_range(ev_data_range* e)
+{
+  mem_access(e->addr, e->len, e->write);
+}
+
+/* statistics scaled to the full run when sampling */
+void print_sampling()
+{
+	unsigned long long measured = loads + stores;
+	double scale;
+
+	if(sample_intervals==0 || measured==0)
+		return;
+	scale = (double)(measured + sample_warmed + sample_skipped) / measured;
+	printf("\nSampling: %u intervals, %llu accesses measured, %llu warm-up, %llu not traced\n",
+		sample_intervals, measured, sample_warmed, sample_skipped);
+	printf("Estimated (x%.2f):  stores %.0f / %.0f, loads %.0f / %.0f\n", scale,
+		smisses * scale, stores * scale, lmisses * scale, loads * scale);
+	printf("Section statistics are for measured accesses, not scaled.\n");
+}
+
+/* Traced regions (McTracer --toggle-events=yes): accesses and misses
+ * between tracing switched on and off */
+#define REGIONS_MAX 64
+
+typedef struct _region {
+	unsigned long long accesses, misses;
+} Region;
+
+Region regions[REGIONS_MAX];
+int region_count = 0;
+int region_open = FALSE;
+unsigned long long region_accesses, region_misses;  // at region start
+
+void region_close()
+{
+	if(!region_open)
+		return;
+	if(region_count < REGIONS_MAX)
+	{
+		regions[region_count].accesses = loads + stores - region_accesses;
+		regions[region_count].misses = lmisses + smisses - region_misses;
+	}
+	region_count++;
+	region_open = FALSE;
+}
+
+void tracing(ev_tracing* e)
+{
+	region_close();
+	if(!e->on)
+		return;
+	region_open = TRUE;
+	region_accesses = loads + stores;
+	region_misses = lmisses + smisses;
+}
+
+void print_regions()
+{
+	int i;
+
+	region_close();
+	if(region_count == 0)
+		return;
+	printf("\nTraced regions: %d\n", region_count);
+	for(i=0; i<region_count && i<REGIONS_MAX; i++)
+		printf("  region %2d: %llu accesses, %llu misses (%.2f%%)\n", i+1,
+			regions[i].accesses, regions[i].misses,
+			regions[i].accesses ? 100.0 * regions[i].misses / regions[i].accesses : 0.0);
+	if(region_count > REGIONS_MAX)
+		printf("  (%d more regions not listed)\n", region_count - REGIONS_MAX);
+}
+
+void configure(ev_simplesim_configure* e)
+{
+	if(layout_configure(e->setting, e->value))
+		return;
+	if(cat_configure(e->setting, e->value))
+		return;
+	if(timing_configure(e->setting, e->value))
+		return;
+	if(strcmp(e->setting, "cachelines") == 0){
+		cachelines = e->value;
+		DEBUG(printf("Reconfigured for %d cachelines\n", cachelines);)
+	}else if(strcmp(e->setting, "setsize") == 0){
+		setsize = e->value;
+	}else if(strcmp(e->setting, "set_stats") == 0){
+		set_stats = e->value;
+	}else if(strcmp(e->setting, "set_window") == 0){
+		set_window = e->value;
+		return;
+	}else if(strcmp(e->setting, "classify_misses") == 0){
+		classify_misses = e->value;
+	}else if(strcmp(e->setting, "victim_cache") == 0 ||
+		 strcmp(e->setting, "miss_cache") == 0){
+		// one buffer behind the cache, 0 entries: none
+		vbuf_entries = e->value;
+		if(vbuf_entries <= 0)
+			vbuf_mode = VBUF_NONE;
+		else
+			vbuf_mode = (e->setting[0] == 'v') ? VBUF_VICTIM : VBUF_MISS;
+	}else if(strcmp(e->setting, "write_allocate") == 0){
+		write_allocate = e->value;
+	}else if(strcmp(e->setting, "traffic") == 0){
+		traffic_report = e->value;
+		return;
+	}else if(strcmp(e->setting, "section_stats") == 0){
+		section_report = e->value;
+		return;
+	}else if(strcmp(e->setting, "prefetcher") == 0){
+		prefetcher = e->value;
+		if(prefetcher < PF_NONE || prefetcher > PF_STRIDE)
+			prefetcher = PF_NONE;
+	}else if(strcmp(e->setting, "prefetch_degree") == 0){
+		prefetch_degree = e->value;
+	}else if(strcmp(e->setting, "prefetch_distance") == 0){
+		prefetch_distance = e->value;
+	}else if(strcmp(e->setting, "prefetch_latency") == 0){
+		prefetch_latency = e->value;
+	}else if(strcmp(e->setting, "tlb") == 0){
+		tlb_enabled = e->value;
+		tlb_clear();
+		return;
+	}else if(strcmp(e->setting, "dtlb_entries") == 0){
+		dtlb.entries = e->value;
+		tlb_clear();
+		return;
+	}else if(strcmp(e->setting, "dtlb_ways") == 0){
+		dtlb.ways = e->value;
+		tlb_clear();
+		return;
+	}else if(strcmp(e->setting, "stlb_entries") == 0){
+		stlb.entries = e->value;
+		tlb_clear();
+		return;
+	}else if(strcmp(e->setting, "stlb_ways") == 0){
+		stlb.ways = e->value;
+		tlb_clear();
+		return;
+	}else if(strcmp(e->setting, "tlb_walk_inject") == 0){
+		tlb_walk_inject = e->value;
+		return;
+	}else if(strcmp(e->setting, "pagesize") == 0){
+		pagesize = e->value;
+		if(pagesize != PAGE_2M && pagesize != PAGE_1G)
+			pagesize = PAGE_4K;
+		return;
+	}else if(strcmp(e->setting, "pc_top") == 0){
+		pc_top = e->value;
+		return;
+	}else if(strcmp(e->setting, "patterns") == 0){
+		pattern_configure(e->value);
+		return;
+	}else if(strcmp(e->setting, "sample_warmup") == 0){
+		sample_warmup = e->value;
+		return;
+	}
+	cache_clear();
+}
+
+void section_table_add(Section* section);
+
+void data_define(ev_simplesim_define_data* define_data){
+  SectionNode* nextSection=sections.first;
+	int lowestID=0;
+	Data* newData;
+	while(nextSection!=NULL)
+	{
+		if(nextSection->section->id < lowestID)
+			lowestID=nextSection->section->id;
+		nextSection=nextSection->next;
+	}
+	newData=malloc(sizeof(Data));
+	newData->start=define_data->start;
+	newData->end=define_data->start+define_data->size;
+	newData->pagesize=pagesize;
+	newData->set_misses=NULL;
+	newData->layout=NULL;
+	newData->section=createSection(lowestID-1, define_data->description);
+	addData(&dataList,newData);
+	data_count++;
+	addSection(&sections,newData->section);
+	section_table_add(newData->section);
+
+  DEBUG(printf("user request, data define %s, start: %p, size %d\n", define_data->description, (void *) define_data->start, define_data->size);)
+}
+
+/* ----------------------------------------------------------------*/
+
+/*
+ * Section table and section stack.
+ *
+ * Sections are found by id in a hash table (open addressing, linear
+ * probing, grown when half full), so switching sections is O(1) for
+ * any id. It also holds data ranges (negative ids), which clients may
+ * switch to like to any other section. The active section is the top
+ * of a stack: TR_SIMPLESIM_PUSH_SECTION nests a section into the active
+ * one, TR_SIMPLESIM_POP_SECTION returns to the enclosing one, and
+ * TR_SIMPLESIM_CHANGE_SECTION replaces the top entry. Each thread has
+ * its own stack, starting in the default section.
+ *
+ * Misses are attributed exclusively to the section at the top, and
+ * inclusively to all sections on the stack (once, even if entered
+ * recursively). Both are derived from the global miss counter at the
+ * time a section is entered and left, so the access path is not
+ * touched. On a thread switch, the sections of the stack switched
+ * away from are left and those of the new stack are entered.
+ */
+
+#define SECTION_STACK_MAX 256
+
+/* ids from here on are function windows, see below */
+#define FN_SECTION_BASE 0x40000000
+
+Section** section_table = NULL;
+unsigned int section_table_size = 0;   // power of 2
+unsigned int section_table_used = 0;
+typedef struct {
+	Section* entry[SECTION_STACK_MAX];
+	int depth;
+} SectionStack;
+
+SectionStack** section_stacks = NULL;   // per thread
+int section_stacks_size = 0;
+SectionStack* section_stack = NULL;     // of running thread
+int section_nesting = FALSE;   // push was used
+
+// table slot of section <id>, or free slot where it is to be inserted
+static inline unsigned int section_slot(int id)
+{
+	unsigned int mask = section_table_size - 1;
+	unsigned int i = line_hash((unsigned int)id) & mask;
+
+	while(section_table[i] && section_table[i]->id != id)
+		i = (i + 1) & mask;
+	return i;
+}
+
+void section_table_add(Section* section)
+{
+	Section** old = section_table;
+	unsigned int i, old_size = section_table_size;
+
+	if(2 * (section_table_used + 1) > section_table_size)
+	{
+		section_table_size = old_size ? 2 * old_size : 64;
+		section_table = calloc(section_table_size, sizeof(Section*));
+		for(i=0; i<old_size; i++)
+			if(old[i])
+				section_table[section_slot(old[i]->id)] = old[i];
+		free(old);
+	}
+	section_table[section_slot(section->id)] = section;
+	section_table_used++;
+}
+
+// section with <id>, created with <description> if not existing
+Section* find_section(unsigned int id, const char* description)
+{
+	Section* section;
+
+	if(section_table_size > 0)
+	{
+		section = section_table[section_slot((int)id)];
+		if(section)
+			return section;
+	}
+	section=createSection(id, description);
+	addSection(&sections,section);
+	section_table_add(section);
+	return section;
+}
+
+void section_enter(Section* s)
+{
+	if(s->on_stack++ == 0)
+		s->incl_start=misses;
+}
+
+void section_leave(Section* s)
+{
+	if(--s->on_stack == 0)
+		s->misses_incl+=misses - s->incl_start;
+}
+
+// make <s> the active section
+void section_activate(Section* s)
+{
+	if(currentSection)
+		currentSection->misses_excl+=misses - currentSection->excl_start;
+	currentSection=s;
+	s->excl_start=misses;
+}
+
+// can client requests use section <id>? Not in the function window range
+int client_section_id(unsigned int id)
+{
+	if((int)id < FN_SECTION_BASE)
+		return TRUE;
+	printf("Section id %u reserved for function windows, request ignored\n", id);
+	return FALSE;
+}
+
+void change_section(ev_simplesim_change_section* section_change){
+	Section* section;
+
+	if(!client_section_id(section_change->id))
+		return;
+	section=find_section(section_change->id, section_change->description);
+
+	section_activate(section);
+	section_leave(section_stack->entry[section_stack->depth-1]);
+	section_stack->entry[section_stack->depth-1]=section;
+	section_enter(section);
+  	DEBUG(printf("user request, change section ID: %d \n",section_change->id);)//
+}
+
+void section_push(Section* section)
+{
+	Section* p;
+
+	if(section_stack->depth == SECTION_STACK_MAX)
+	{
+		printf("Section stack overflow, ignoring push of section %d\n", section->id);
+		return;
+	}
+	section_nesting=TRUE;
+	if(section->parent==NULL)
+	{
+		// first enclosing section, if this does not create a cycle
+		for(p=currentSection; p!=NULL && p!=section; p=p->parent);
+		if(p==NULL)
+			section->parent=currentSection;
+	}
+	section_activate(section);
+	section_stack->entry[section_stack->depth++]=section;
+	section_enter(section);
+}
+
+void section_pop(int id)
+{
+	if(section_stack->depth <= 1)
+	{
+		printf("Section stack underflow, ignoring pop of section %d\n", id);
+		return;
+	}
+	if(currentSection->id != id)
+		printf("Pop of section %d while in section %d\n",
+			id, currentSection->id);
+	section_leave(section_stack->entry[--section_stack->depth]);
+	section_activate(section_stack->entry[section_stack->depth-1]);
+}
+
+// switch to the section stack of thread <t>
+void sections_thread(int t)
+{
+	SectionStack* ss;
+	int i, size;
+
+	if(t >= section_stacks_size)
+	{
+		size = section_stacks_size ? section_stacks_size : 16;
+		while(size <= t)
+			size *= 2;
+		section_stacks = realloc(section_stacks, size * sizeof(SectionStack*));
+		memset(section_stacks + section_stacks_size, 0,
+			(size - section_stacks_size) * sizeof(SectionStack*));
+		section_stacks_size = size;
+	}
+	ss = section_stacks[t];
+	if(ss == NULL)
+	{
+		ss = section_stacks[t] = malloc(sizeof(SectionStack));
+		ss->entry[0] = find_section(0, "default");
+		ss->depth = 1;
+	}
+	if(ss == section_stack)
+		return;
+
+	if(section_stack)
+		for(i=0; i<section_stack->depth; i++)
+			section_leave(section_stack->entry[i]);
+	section_stack = ss;
+	for(i=0; i<ss->depth; i++)
+		section_enter(ss->entry[i]);
+	section_activate(ss->entry[ss->depth-1]);
+}
+
+void push_section(ev_simplesim_change_section* e)
+{
+	if(!client_section_id(e->id))
+		return;
+	section_push(find_section(e->id, e->description));
+	DEBUG(printf("user request, push section ID: %d \n",e->id);)
+}
+
+void pop_section(ev_simplesim_pop_section* e)
+{
+	if(!client_section_id(e->id))
+		return;
+	section_pop((int)e->id);
+	DEBUG(printf("user request, pop section ID: %d \n",e->id);)
+}
+
+/* Function windows (McTracer --trace-fn): each traced function is a
+ * section with id FN_SECTION_BASE + function id, named like the
+ * function. Entering/leaving a window pushes/pops its section.
+ * Client requests for ids in this range are ignored.
+ */
+
+char** fn_names = NULL;
+Section** fn_sections = NULL;
+unsigned int fn_names_size = 0;
+
+void fn_info(ev_fn_info* e)
+{
+	unsigned int size;
+
+	if(e->id >= fn_names_size)
+	{
+		size = fn_names_size ? fn_names_size : 256;
+		while(size <= e->id)
+			size *= 2;
+		fn_names = realloc(fn_names, size * sizeof(char*));
+		fn_sections = realloc(fn_sections, size * sizeof(Section*));
+		memset(fn_names + fn_names_size, 0, (size - fn_names_size) * sizeof(char*));
+		memset(fn_sections + fn_names_size, 0, (size - fn_names_size) * sizeof(Section*));
+		fn_names_size = size;
+	}
+	free(fn_names[e->id]);
+	fn_names[e->id] = strdup(e->name);
+}
+
+const char* fn_name(unsigned int id)
+{
+	static char name[32];
+
+	if(id < fn_names_size && fn_names[id] != NULL)
+		return fn_names[id];
+	// no TR_FN_INFO seen
+	sprintf(name, "fn %u", id);
+	return name;
+}
+
+Section* fn_section(unsigned int id)
+{
+	if(id >= fn_names_size)
+		return find_section(FN_SECTION_BASE + id, fn_name(id));
+	if(fn_sections[id] == NULL)
+		fn_sections[id] = find_section(FN_SECTION_BASE + id, fn_name(id));
+	return fn_sections[id];
+}
+
+void fn_enter(ev_fn* e)
+{
+	section_push(fn_section(e->id));
+}
+
+void fn_leave(ev_fn* e)
+{
+	section_pop(fn_section(e->id)->id);
+}
+
+/* Calling context tree (McTracer --calls=yes)
+ *
+ * Each thread has a shadow call stack of CCT nodes. Accesses and
+ * misses are charged exclusively to the node at the top of the
+ * stack of the running thread, derived from the global counters at
+ * calls, returns and thread switches, so the access path is not
+ * touched. A node's context includes all contexts below it, so
+ * inclusive costs are summed up the tree at exit: costs of other
+ * threads never end up in a node.
+ * Nodes are kept in one array (index 0 is the root, for accesses
+ * outside of any call seen), and children are found via a hash of
+ * (parent, function). Direct recursion stays in the same node, and
+ * the context is not refined below depth CCT_DEPTH_MAX: memory
+ * depends on the number of distinct call paths, not on call depth.
+ */
+
+#define CCT_DEPTH_MAX 128
+
+typedef struct {
+	unsigned int fn;
+	int parent, first_child, next_sibling;
+	int depth;
+	unsigned long long calls;     // from parent
+	unsigned long long accesses_excl, misses_excl;
+	unsigned long long accesses_incl, misses_incl;
+} CCTNode;
+
+CCTNode* cct = NULL;
+int cct_used = 0, cct_size = 0;
+
+int* cct_hash = NULL;             // node indexes, 0 is empty
+unsigned int cct_hash_size = 0;
+
+typedef struct {
+	int node;
+	Addr sp;                      // stack pointer at function entry
+} CallFrame;
+
+typedef struct {
+	CallFrame* frame;
+	int depth, size;
+} CallStack;
+
+CallStack* call_stacks = NULL;
+int call_stacks_size = 0;
+CallStack* call_stack = NULL;     // of running thread
+int calls_seen = FALSE;
+
+// counters at last charge to the top node of the running thread
+unsigned long long cct_accesses = 0, cct_misses = 0;
+
+char* callgrind_file = NULL;
+
+static inline unsigned int cct_hash_of(int parent, unsigned int fn)
+{
+	return ((unsigned int)parent * 2654435761u) ^ (fn * 40503u);
+}
+
+void cct_hash_insert(int node)
+{
+	unsigned int i = cct_hash_of(cct[node].parent, cct[node].fn) & (cct_hash_size - 1);
+
+	while(cct_hash[i])
+		i = (i + 1) & (cct_hash_size - 1);
+	cct_hash[i] = node;
+}
+
+int cct_new(int parent, unsigned int fn)
+{
+	int n, i;
+
+	if(cct_used == cct_size)
+	{
+		cct_size = cct_size ? 2*cct_size : 1024;
+		cct = realloc(cct, cct_size * sizeof(CCTNode));
+	}
+	n = cct_used++;
+	memset(&cct[n], 0, sizeof(CCTNode));
+	cct[n].fn = fn;
+	cct[n].parent = parent;
+	cct[n].first_child = -1;
+	cct[n].next_sibling = -1;
+	if(parent < 0)
+		return n;
+
+	cct[n].depth = cct[parent].depth + 1;
+	cct[n].next_sibling = cct[parent].first_child;
+	cct[parent].first_child = n;
+
+	if(2 * (unsigned int)cct_used > cct_hash_size)
+	{
+		free(cct_hash);
+		cct_hash_size = cct_hash_size ? 2*cct_hash_size : 4096;
+		cct_hash = calloc(cct_hash_size, sizeof(int));
+		for(i=1; i<n; i++)
+			cct_hash_insert(i);
+	}
+	cct_hash_insert(n);
+	return n;
+}
+
+// child of <parent> for function <fn>, created if not existing
+int cct_child(int parent, unsigned int fn)
+{
+	unsigned int i;
+	int n;
+
+	if(cct_hash_size > 0)
+	{
+		i = cct_hash_of(parent, fn) & (cct_hash_size - 1);
+		while((n = cct_hash[i]) != 0)
+		{
+			if(cct[n].parent == parent && cct[n].fn == fn)
+				return n;
+			i = (i + 1) & (cct_hash_size - 1);
+		}
+	}
+	return cct_new(parent, fn);
+}
+
+// charge costs since last charge to top node of running thread
+void cct_charge()
+{
+	CCTNode* n;
+
+	if(!call_stack)
+		return;
+	n = &cct[call_stack->depth ? call_stack->frame[call_stack->depth-1].node : 0];
+	n->accesses_excl += loads + stores - cct_accesses;
+	n->misses_excl += misses - cct_misses;
+	cct_accesses = loads + stores;
+	cct_misses = misses;
+}
+
+// finish calls of running thread entered with stack pointer below <sp>
+void calls_unwind(Addr sp)
+{
+	while(call_stack->depth > 0 && call_stack->frame[call_stack->depth-1].sp < sp)
+		call_stack->depth--;
+}
+
+void calls_thread(int t)
+{
+	int size;
+
+	if(!calls_seen)
+		return;
+	cct_charge();
+	if(t >= call_stacks_size)
+	{
+		size = call_stacks_size ? call_stacks_size : 16;
+		while(size <= t)
+			size *= 2;
+		call_stacks = realloc(call_stacks, size * sizeof(CallStack));
+		memset(call_stacks + call_stacks_size, 0,
+			(size - call_stacks_size) * sizeof(CallStack));
+		call_stacks_size = size;
+	}
+	call_stack = &call_stacks[t];
+}
+
+void calls_start()
+{
+	calls_seen = TRUE;
+	cct_new(-1, 0);
+	calls_thread(tid);
+}
+
+void call(ev_call* e)
+{
+	CallStack* cs;
+	int top, node;
+
+	if(!calls_seen)
+		calls_start();
+	cct_charge();
+
+	// calls not finished by a return seen, e.g. on tail calls
+	calls_unwind(e->sp + 1);
+
+	cs = call_stack;
+	top = cs->depth ? cs->frame[cs->depth-1].node : 0;
+	if(cct[top].fn == e->id || cct[top].depth == CCT_DEPTH_MAX)
+		node = top;
+	else
+	{
+		node = cct_child(top, e->id);
+		cct[node].calls++;
+	}
+	if(cs->depth == cs->size)
+	{
+		cs->size = cs->size ? 2*cs->size : 64;
+		cs->frame = realloc(cs->frame, cs->size * sizeof(CallFrame));
+	}
+	cs->frame[cs->depth].node = node;
+	cs->frame[cs->depth].sp = e->sp;
+	cs->depth++;
+}
+
+void ret(ev_return* e)
+{
+	if(!calls_seen)
+		return;
+	cct_charge();
+	calls_unwind(e->sp);
+}
+
+// sum up inclusive costs at exit (children are created after parents)
+void calls_finish()
+{
+	int i;
+
+	if(!calls_seen)
+		return;
+	cct_charge();
+	for(i=0; i<cct_used; i++)
+	{
+		cct[i].accesses_incl = cct[i].accesses_excl;
+		cct[i].misses_incl = cct[i].misses_excl;
+	}
+	for(i=cct_used-1; i>0; i--)
+	{
+		cct[cct[i].parent].accesses_incl += cct[i].accesses_incl;
+		cct[cct[i].parent].misses_incl += cct[i].misses_incl;
+	}
+}
+
+void print_cct_tree(int node, int depth)
+{
+	CCTNode* n = &cct[node];
+	int c;
+
+	printf("  %*s%-*s incl %8llu (%5.1f%%), excl %8llu (%5.1f%%), %llu calls\n",
+		2*depth, "", depth < 12 ? 24-2*depth : 0,
+		node ? fn_name(n->fn) : "(outside)",
+		n->misses_incl, misses ? 100.0 * n->misses_incl / misses : 0.0,
+		n->misses_excl, misses ? 100.0 * n->misses_excl / misses : 0.0,
+		n->calls);
+	for(c=n->first_child; c>=0; c=cct[c].next_sibling)
+		if(100 * cct[c].misses_incl >= misses && cct[c].misses_incl > 0)
+			print_cct_tree(c, depth+1);
+}
+
+/* Callgrind format: costs are given per function, with calls between
+ * functions (each node gives the self cost of its function and the
+ * inclusive cost of calls to its children). Readers sum up costs of
+ * all call paths, so this loads like a callgrind profile. */
+void write_callgrind(const char* file)
+{
+	FILE* f;
+	char* named;
+	int i, c;
+	unsigned int id, max_id = 0;
+
+	f = fopen(file, "w");
+	if(!f)
+	{
+		printf("Cannot write call contexts to '%s'\n", file);
+		return;
+	}
+	fprintf(f, "# callgrind format\nversion: 1\ncreator: simplesim\n");
+	if(exe_path[0])
+		fprintf(f, "cmd: %s\n", exe_path);
+	fprintf(f, "positions: line\nevents: Ac Mi\n"
+		"event: Ac : Accesses\nevent: Mi : Misses\n"
+		"summary: %llu %llu\n\nfl=(1) ???\n",
+		cct[0].accesses_incl, cct[0].misses_incl);
+
+	// names are given once, with compressed id = function id + 1
+	for(i=0; i<cct_used; i++)
+		if(cct[i].fn > max_id)
+			max_id = cct[i].fn;
+	named = calloc(max_id + 1, 1);
+	for(i=0; i<cct_used; i++)
+	{
+		id = cct[i].fn;
+		if(!named[id])
+		{
+			fprintf(f, "\nfn=(%u) %s\n", id + 1, i ? fn_name(id) : "(outside)");
+			named[id] = 1;
+		}
+		else
+			fprintf(f, "\nfn=(%u)\n", id + 1);
+		fprintf(f, "0 %llu %llu\n", cct[i].accesses_excl, cct[i].misses_excl);
+		for(c=cct[i].first_child; c>=0; c=cct[c].next_sibling)
+		{
+			id = cct[c].fn;
+			if(!named[id])
+			{
+				fprintf(f, "cfn=(%u) %s\n", id + 1, fn_name(id));
+				named[id] = 1;
+			}
+			else
+				fprintf(f, "cfn=(%u)\n", id + 1);
+			fprintf(f, "calls=%llu 0\n0 %llu %llu\n", cct[c].calls,
+				cct[c].accesses_incl, cct[c].misses_incl);
+		}
+	}
+	free(named);
+	fclose(f);
+	printf("Call contexts written to '%s'\n", file);
+}
+
+void print_calls()
+{
+	char file[64];
+	int i, max_depth = 0;
+
+	if(!calls_seen)
+		return;
+	for(i=0; i<cct_used; i++)
+		if(cct[i].depth > max_depth)
+			max_depth = cct[i].depth;
+	printf("\nCall contexts: %d, depth up to %d\n", cct_used - 1, max_depth);
+	printf("Call context misses (inclusive / exclusive, of %u, contexts above 1%%):\n", misses);
+	print_cct_tree(0, 0);
+
+	if(!callgrind_file || !callgrind_file[0])
+	{
+		snprintf(file, sizeof(file), "callgrind.out.%d", (int) getpid());
+		callgrind_file = file;
+	}
+	write_callgrind(callgrind_file);
+}
+
+// close inclusive/exclusive counting at exit
+void sections_finish()
+{
+	section_activate(currentSection);
+	while(section_stack->depth > 0)
+		section_leave(section_stack->entry[--section_stack->depth]);
+}
+
+void print_section_tree(Section* s, int depth)
+{
+	SectionNode* next;
+
+	printf("  %*s%-*s incl %8llu (%5.1f%%), excl %8llu (%5.1f%%)\n",
+		2*depth, "", 24-2*depth, s->description,
+		s->misses_incl, misses ? 100.0 * s->misses_incl / misses : 0.0,
+		s->misses_excl, misses ? 100.0 * s->misses_excl / misses : 0.0);
+	if(depth >= SECTION_STACK_MAX)
+		return;
+	for(next=sections.first; next!=NULL; next=next->next)
+		if(next->section->parent==s)
+			print_section_tree(next->section, depth+1);
+}
+
+void print_section_nesting()
+{
+	SectionNode* next;
+
+	if(!section_nesting)
+		return;
+	printf("\nSection misses (inclusive / exclusive, of %u):\n", misses);
+	for(next=sections.first; next!=NULL; next=next->next)
+		if(next->section->parent==NULL && next->section->id >= 0)
+			print_section_tree(next->section, 0);
+}
+
+int main(int argc, char* argv[])
+{
+    
+    cache_clear();
+    
+    int i;
+    sections_thread(tid);
+    
+    shm_buf* buf;
+    shm_rb* rb;
+    rb_chunk* chunk;
+    tr_event* e;
+    tr_decoder dec;
+
+    /* "--callgrind=<file>": call contexts with McTracer --calls=yes,
+     * default callgrind.out.<pid> */
+    callgrind_file = getenv("SIMPLESIM_CALLGRIND");
+    for(i=1; i<argc; i++)
+      if (strncmp(argv[i], "--callgrind=", 12) == 0)
+        callgrind_file = argv[i] + 12;
+
+    /* initialize event passing via shared memory */
+    buf = shm_init(argc, argv);
+    rb = open_rb(buf, "tr_main");
+    if (!rb) {
+      printf("Cannot open ring buffer 'tr_main'\n");
+      exit(1);
+    }
+
+
+
+    chunk = open_first(rb);
+    tr_decoder_init(&dec);
+    while( (e = next_tr_event(&dec, &chunk)) ) {
+      pc = dec.pc;
+      switch(e->tag) {
+      case TR_RUN_TID:
 	run_tid(&(e->run_tid));
 	break;
       case TR_DATA_READ:
@@ -473,15 +3783,51 @@ int main(int argc, char* argv[])
       case TR_DATA_WRITE:
 	data_write(&(e->data_write));
 	break;
+      case TR_DATA_RANGE:
+	data_range(&(e->data_range));
+	break;
       case TR_SIMPLESIM_DEFINE_DATA:
 	data_define(&(e->simplesim_define_data));
 	break;
 	  case TR_SIMPLESIM_CHANGE_SECTION:
   	change_section(&(e->simplesim_change_section));
   	break;
+      case TR_SIMPLESIM_PUSH_SECTION:
+	push_section(&(e->simplesim_change_section));
+	break;
+      case TR_SIMPLESIM_POP_SECTION:
+	pop_section(&(e->simplesim_pop_section));
+	break;
   	  case TR_SIMPLESIM_CONFIGURE:
     configure(&(e->simplesim_configure));
     break;
+      case TR_SAMPLE:
+	sample(&(e->sample));
+	break;
+      case TR_EXE_INFO:
+	snprintf(exe_path, sizeof(exe_path), "%s", e->exe_info.path);
+	break;
+      case TR_OBJ_INFO:
+	obj_info(&(e->obj_info));
+	break;
+      case TR_TRACING:
+	tracing(&(e->tracing));
+	break;
+      case TR_FN_INFO:
+	fn_info(&(e->fn_info));
+	break;
+      case TR_FN_ENTER:
+	fn_enter(&(e->fn));
+	break;
+      case TR_FN_LEAVE:
+	fn_leave(&(e->fn));
+	break;
+      case TR_CALL:
+	call(&(e->call));
+	break;
+      case TR_RETURN:
+	ret(&(e->ret));
+	break;
       default:
 	printf(" Unknown event tag %d\n", e->tag);
 	abort();
@@ -490,9 +3836,32 @@ int main(int argc, char* argv[])
     }
     //save remaining cachelines
     for(i=0;i<cachelines;++i)
-      save_line(cache[i]);
+    {
+      save_line(&cache[i]);
+      writeback_line(&cache[i]);
+    }
       
 
+    sections_finish();
+    calls_finish();
+
+    print_traffic();
+    print_section_stats();
+    print_section_nesting();
+    print_classification();
+    print_set_stats();
+    print_prefetch();
+    print_tlb();
+    print_layout();
+    print_cat();
+    print_vbuf();
+    print_timing();
+    print_pcstats();
+    print_patterns();
+    print_sampling();
+    print_regions();
+    print_calls();
+
     printf("\n[%d,",misses);
     //write all sections
 	SectionNode* next=sections.first;
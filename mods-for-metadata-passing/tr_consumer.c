@@ -0,0 +1,342 @@
+/*
+ * Event consumer for mctracer: event dump and trace converter.
+ * For ETI @ TUM, (C) 2011 Josef Weidendorfer
+ *
+ * Writes all memory accesses into a file (default: stdout) in one of
+ * the formats
+ *  text: "Data Read 0x<addr>,<len>" lines as before (default)
+ *  din:  Dinero IV "din" format ("<0|1> <hexaddr>"). Records have no
+ *        size, so an access gets one record per line it touches
+ *  bin:  binary records as used by the access log of simplesim
+ *        (see simlog.h, convert with simlog2txt)
+ *
+ * Options:
+ *  --format=text|din|bin
+ *  --din-line=<bytes>    line size for din records (power of 2) [64]
+ *  --output=<file>
+ *  --addr=<start>-<end>  only accesses touching [start,end[ (hex)
+ *  --tid=<n>             only accesses of thread <n>
+ *
+ * Formatting is done by hand into a large output buffer, so the
+ * dump keeps up with the event producer.
+ *
+ * Build this in ../simplesim:
+ *  cc -O2 -I. -o tr-consumer ../mods-for-metadata-passing/tr_consumer.c \
+ *     shmlib/shm_consumer.c shmlib/shm_import.c
+ */
+
+#include "shmlib/shm_consumer.h"
+
+// 64-bit type for addresses: this needs mctracer to be 64bit binary !!
+typedef unsigned long long Addr;
+
+#include "tr_shmevents.h"
+#include "tr_decode.h"
+#include "simlog.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define FORMAT_TEXT 0
+#define FORMAT_DIN  1
+#define FORMAT_BIN  2
+
+static int format = FORMAT_TEXT;
+static int out_fd = 1;
+static Addr din_line = 64;
+
+// filters
+static Addr addr_start = 0, addr_end = ~0ULL;
+static int filter_tid = -1;
+
+static int tid = 0;
+static unsigned long long written = 0, filtered = 0;
+
+/* output buffer, flushed when less than OUT_RESERVE bytes are free */
+#define OUT_SIZE    (1<<20)
+#define OUT_RESERVE 256
+
+static char out_buf[OUT_SIZE];
+static char* out = out_buf;
+
+static void out_flush()
+{
+  char* p = out_buf;
+  ssize_t n;
+
+  while(p < out) {
+    n = write(out_fd, p, out - p);
+    if (n <= 0) {
+      perror("tr-consumer: write");
+      exit(1);
+    }
+    p += n;
+  }
+  out = out_buf;
+}
+
+static inline void out_check()
+{
+  if (out > out_buf + OUT_SIZE - OUT_RESERVE) out_flush();
+}
+
+/* put_* functions append to buffer position <p> and return the new
+ * position; using a local position instead of <out> avoids reloading
+ * the global pointer after each byte stored */
+static inline char* put_str(char* p, const char* s)
+{
+  while(*s) *p++ = *s++;
+  return p;
+}
+
+static inline char* put_hex(char* p, Addr a)
+{
+  static const char digits[] = "0123456789abcdef";
+  char* end;
+  int n = 1;
+
+  // number of digits
+  while((n < 16) && (a >> (4*n))) n++;
+  end = p + n;
+  p = end;
+  do {
+    *--p = digits[a & 15];
+    a >>= 4;
+  } while(--n);
+  return end;
+}
+
+static inline char* put_dec(char* p, unsigned int v)
+{
+  char tmp[10];
+  int n = 0;
+
+  do {
+    tmp[n++] = '0' + v % 10;
+    v /= 10;
+  } while(v);
+  while(n > 0) *p++ = tmp[--n];
+  return p;
+}
+
+void run_tid(ev_run_tid* e)
+{
+  tid = e->tid;
+  if (format != FORMAT_TEXT) return;
+  if ((filter_tid >= 0) && (tid != filter_tid)) return;
+
+  out_check();
+  out = put_str(out, "Thread ");
+  out = put_dec(out, tid);
+  *out++ = '\n';
+}
+
+void tracing(ev_tracing* e)
+{
+  if (format != FORMAT_TEXT) return;
+
+  out_check();
+  out = put_str(out, e->on ? "Tracing on\n" : "Tracing off\n");
+}
+
+/* function names from TR_FN_INFO, for window events */
+static char** fn_names = 0;
+static unsigned int fn_names_size = 0;
+
+void fn_info(ev_fn_info* e)
+{
+  unsigned int size = fn_names_size ? fn_names_size : 256;
+
+  if (e->id >= fn_names_size) {
+    while(size <= e->id) size *= 2;
+    fn_names = realloc(fn_names, size * sizeof(char*));
+    memset(fn_names + fn_names_size, 0, (size - fn_names_size) * sizeof(char*));
+    fn_names_size = size;
+  }
+  free(fn_names[e->id]);
+  fn_names[e->id] = strdup(e->name);
+}
+
+void fn_window(ev_fn* e, int enter)
+{
+  if (format != FORMAT_TEXT) return;
+  if ((filter_tid >= 0) && (tid != filter_tid)) return;
+
+  out_check();
+  out = put_str(out, enter ? "Enter " : "Leave ");
+  if ((e->id < fn_names_size) && fn_names[e->id])
+    // names are up to 240 bytes, within OUT_RESERVE
+    out = put_str(out, fn_names[e->id]);
+  else
+    out = put_dec(out, e->id);
+  *out++ = '\n';
+}
+
+void data_access(Addr addr, unsigned int len, int write, Addr pc)
+{
+  simlog_record* r;
+  char* p;
+  Addr a;
+
+  if (((filter_tid >= 0) && (tid != filter_tid)) ||
+      (addr + len <= addr_start) || (addr >= addr_end)) {
+    filtered++;
+    return;
+  }
+  written++;
+
+  out_check();
+  p = out;
+  switch(format) {
+  case FORMAT_TEXT:
+    p = put_str(p, write ? "Data Write 0x" : "Data Read 0x");
+    p = put_hex(p, addr);
+    *p++ = ',';
+    p = put_dec(p, len);
+    if (pc) {
+      p = put_str(p, " at 0x");
+      p = put_hex(p, pc);
+    }
+    *p++ = '\n';
+    break;
+
+  case FORMAT_DIN:
+    // first address of the access in each line touched
+    a = addr;
+    while(1) {
+      *p++ = write ? '1' : '0';
+      *p++ = ' ';
+      p = put_hex(p, a);
+      *p++ = '\n';
+      a = (a & ~(din_line - 1)) + din_line;
+      if (a >= addr + len) break;
+      if (p > out_buf + OUT_SIZE - OUT_RESERVE) {
+	out = p;
+	out_flush();
+	p = out;
+      }
+    }
+    break;
+
+  case FORMAT_BIN:
+    r = (simlog_record*) p;
+    r->addr = addr;
+    r->len = len;
+    r->tid = tid;
+    r->flags = write ? SIMLOG_WRITE : 0;
+    r->reserved = 0;
+    p += sizeof(simlog_record);
+    break;
+  }
+  out = p;
+}
+
+static void usage(char* prg)
+{
+  printf("Usage: %s [options] [<pid>]\n"
+	 "  --format=text|din|bin  output format [text]\n"
+	 "  --din-line=<bytes>     line size for din records [64]\n"
+	 "  --output=<file>        write to <file> instead of stdout\n"
+	 "  --addr=<start>-<end>   only accesses in address range (hex)\n"
+	 "  --tid=<n>              only accesses of thread <n>\n", prg);
+  exit(1);
+}
+
+int main(int argc, char* argv[])
+{
+    shm_buf* buf;
+    shm_rb* rb;
+    rb_chunk* chunk;
+    tr_event* e;
+    tr_decoder d;
+    char* output = 0;
+    char* end;
+    int i;
+
+    // our options are ignored by shm_init()
+    for(i=1; i<argc; i++) {
+      if (strcmp(argv[i], "--format=text") == 0) format = FORMAT_TEXT;
+      else if (strcmp(argv[i], "--format=din") == 0) format = FORMAT_DIN;
+      else if (strcmp(argv[i], "--format=bin") == 0) format = FORMAT_BIN;
+      else if (strncmp(argv[i], "--din-line=", 11) == 0) {
+	din_line = strtoull(argv[i] + 11, &end, 10);
+	if (*end || (din_line == 0) || (din_line & (din_line - 1))) usage(argv[0]);
+      }
+      else if (strncmp(argv[i], "--output=", 9) == 0) output = argv[i] + 9;
+      else if (strncmp(argv[i], "--tid=", 6) == 0)
+	filter_tid = atoi(argv[i] + 6);
+      else if (strncmp(argv[i], "--addr=", 7) == 0) {
+	addr_start = strtoull(argv[i] + 7, &end, 16);
+	if (*end != '-') usage(argv[0]);
+	addr_end = strtoull(end + 1, &end, 16);
+	if (*end || (addr_end <= addr_start)) usage(argv[0]);
+      }
+      else if ((argv[i][0] == '-') && (argv[i][1] == '-'))
+	usage(argv[0]);
+    }
+
+    if (output) {
+      out_fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (out_fd < 0) {
+	perror(output);
+	exit(1);
+      }
+    }
+
+    if (format == FORMAT_BIN) {
+      simlog_header* h = (simlog_header*) out;
+      memset(h, 0, sizeof(simlog_header));
+      memcpy(h->magic, SIMLOG_MAGIC, 8);
+      h->record_size = sizeof(simlog_record);
+      out += sizeof(simlog_header);
+    }
+
+    buf = shm_init(argc, argv);
+    rb = open_rb(buf, "tr_main");
+    if (!rb) {
+      printf("Cannot open ring buffer 'tr_main'\n");
+      exit(1);
+    }
+
+    tr_decoder_init(&d);
+    chunk = open_first(rb);
+    while( (e = next_tr_event(&d, &chunk)) ) {
+      switch(e->tag) {
+      case TR_RUN_TID:
+	run_tid(&(e->run_tid));
+	break;
+      case TR_DATA_READ:
+	data_access(e->data_read.addr, e->data_read.len, 0, d.pc);
+	break;
+      case TR_DATA_WRITE:
+	data_access(e->data_write.addr, e->data_write.len, 1, d.pc);
+	break;
+      case TR_DATA_RANGE:
+	data_access(e->data_range.addr, e->data_range.len,
+		    e->data_range.write, 0);
+	break;
+      case TR_TRACING:
+	tracing(&(e->tracing));
+	break;
+      case TR_FN_INFO:
+	fn_info(&(e->fn_info));
+	break;
+      case TR_FN_ENTER:
+      case TR_FN_LEAVE:
+	fn_window(&(e->fn), e->tag == TR_FN_ENTER);
+	break;
+      default:
+	// no memory accesses
+	break;
+      }
+    }
+    out_flush();
+    if (output) close(out_fd);
+
+    fprintf(stderr, "tr-consumer: %llu accesses written, %llu filtered\n",
+	    written, filtered);
+    return 0;
+}
@@ -0,0 +1,140 @@
+/*
+ * McTracer: memory event tracer via event bridge.
+ * Consumer side decoding of compound events.
+ *
+ * next_tr_event() is used instead of next_event(). It expands
+ * TR_DATA_MULTI events into single TR_DATA_READ/TR_DATA_WRITE
+ * events, so consumers do not need to know about batching.
+ * Events with instruction address (--pc=yes) also are returned as
+ * TR_DATA_READ/TR_DATA_WRITE, the address is in the <pc> member
+ * of the decoder (0 if unknown).
+ *
+ * For ETI @ TUM, (C) 2011 Josef Weidendorfer
+ */
+
+#ifndef TR_DECODE_H
+#define TR_DECODE_H
+
+// needs tr_shmevents.h and shm_consumer.h included before
+
+#include <stdlib.h>
+#include <string.h>
+
+// instruction addresses of a received TR_PC_TABLE
+typedef struct {
+  Addr* pc;
+  unsigned int count;
+} tr_pc_table;
+
+typedef struct {
+  ev_data_multi* multi;  // compound event currently expanded, or 0
+  int next;              // index of next access to return from <multi>
+  tr_event ev;           // storage for the expanded event
+
+  Addr pc;               // instruction address of returned access
+
+  // received PC tables, indexed by table id
+  tr_pc_table* pc_table;
+  unsigned int pc_tables;
+} tr_decoder;
+
+static inline
+void tr_decoder_init(tr_decoder* d)
+{
+  d->multi = 0;
+  d->next = 0;
+  d->pc = 0;
+  d->pc_table = 0;
+  d->pc_tables = 0;
+}
+
+// store PC table <t>, replacing a table received before with same id.
+// Tables with invalid id or count are ignored.
+static inline
+void tr_add_pc_table(tr_decoder* d, ev_pc_table* t)
+{
+  tr_pc_table* pt;
+
+  if ((t->id == 0) || (t->id >= TR_PC_TABLES_MAX) ||
+      (t->count > TR_DATA_MULTI_MAX)) return;
+
+  if (t->id >= d->pc_tables) {
+    unsigned int n = d->pc_tables ? d->pc_tables : 1024;
+    while(n <= t->id) n *= 2;
+    d->pc_table = realloc(d->pc_table, n * sizeof(tr_pc_table));
+    memset(d->pc_table + d->pc_tables, 0,
+	   (n - d->pc_tables) * sizeof(tr_pc_table));
+    d->pc_tables = n;
+  }
+  pt = &(d->pc_table[t->id]);
+  free(pt->pc);
+  pt->pc = malloc(t->count * sizeof(Addr));
+  memcpy(pt->pc, t->pc, t->count * sizeof(Addr));
+  pt->count = t->count;
+}
+
+// instruction address at index <idx> of PC table <pcs>, 0 if unknown
+static inline
+Addr tr_lookup_pc(tr_decoder* d, unsigned int pcs, unsigned int idx)
+{
+  if ((pcs == 0) || (pcs >= d->pc_tables) ||
+      (idx >= d->pc_table[pcs].count)) return 0;
+  return d->pc_table[pcs].pc[idx];
+}
+
+// returned event is valid until next call
+static inline
+tr_event* next_tr_event(tr_decoder* d, rb_chunk** cPtr)
+{
+  tr_event* e;
+  int i;
+
+  while(1) {
+    if (d->multi) {
+      i = d->next;
+      if (i < d->multi->count) {
+	d->next++;
+	// read and write events have same layout
+	d->ev.tag = (d->multi->kinds & (1u << i)) ? TR_DATA_WRITE : TR_DATA_READ;
+	d->ev.len = 2 + sizeof(ev_data_read);
+	d->ev.data_read.addr = d->multi->addr[i];
+	d->ev.data_read.len  = d->multi->len[i];
+	d->pc = tr_lookup_pc(d, d->multi->pcs, i);
+	return &(d->ev);
+      }
+      // the compound event lives in the ring buffer chunk, which
+      // may be released by next_event() below
+      d->multi = 0;
+    }
+
+    e = (tr_event*) next_event(cPtr);
+    if (!e) return 0;
+
+    switch(e->tag) {
+    case TR_DATA_MULTI:
+      d->multi = &(e->data_multi);
+      d->next = 0;
+      break;
+
+    case TR_PC_TABLE:
+      tr_add_pc_table(d, &(e->pc_table));
+      break;
+
+    case TR_DATA_READ_PC:
+    case TR_DATA_WRITE_PC:
+      // read and write events have same layout
+      d->ev.tag = (e->tag == TR_DATA_WRITE_PC) ? TR_DATA_WRITE : TR_DATA_READ;
+      d->ev.len = 2 + sizeof(ev_data_read);
+      d->ev.data_read.addr = e->data_read_pc.addr;
+      d->ev.data_read.len  = e->data_read_pc.len;
+      d->pc = tr_lookup_pc(d, e->data_read_pc.pcs, e->data_read_pc.idx);
+      return &(d->ev);
+
+    default:
+      d->pc = 0;
+      return e;
+    }
+  }
+}
+
+#endif
@@ -36,6 +36,8 @@
 #include "pub_tool_options.h"
 #include "pub_tool_machine.h"     // VG_(fnptr_to_fnentry)
 #include "pub_tool_threadstate.h"
+#include "pub_tool_transtab.h"    // VG_(discard_translations)
+#include "pub_tool_mallocfree.h"
 
 #include "shm_vgprod.h"
 #include "tr_shmevents.h"
@@ -44,6 +46,12 @@
 
 static Bool mt_tracing_state = False;
 
+static ThreadId last_trace_tid = -1;
+static ThreadId last_seen_tid = -1;
+
+/* Event bridge writing state */
+static rb_state bridge_state;
+
 /*------------------------------------------------------------*/
 /*--- Command line options                                 ---*/
 /*------------------------------------------------------------*/
@@ -61,11 +69,53 @@ static Char* clo_consumer = "./tr-consumer";
 /* Should we start the event consumer? */
 static Bool  clo_run_consumer = True;
 
+/* Send accesses of a superblock as one TR_DATA_MULTI event? */
+static Bool  clo_batch = False;
+
+/* Attach instruction addresses to access events? */
+static Bool  clo_pc = False;
+
+/* Send TR_TRACING events when tracing is switched on/off? */
+static Bool  clo_toggle_events = False;
+
+/* Trace only inside functions matching one of these patterns */
+#define TRACE_FN_MAX 16
+static Char* clo_trace_fn[TRACE_FN_MAX];
+static Int   clo_trace_fn_count = 0;
+
+/* Send function entries and returns? */
+static Bool  clo_calls = False;
+
+/* Burst sampling: alternate between <clo_sample_on> units traced and
+ * <clo_sample_off> units not traced. Disabled if clo_sample_off is 0.
+ * Units are guest memory accesses or guest instructions. */
+typedef enum { SampleAccesses, SampleInstrs } SampleUnit;
+static Long       clo_sample_on = 0;
+static Long       clo_sample_off = 0;
+static SampleUnit clo_sample_unit = SampleAccesses;
+
 static Bool mt_process_cmd_line_option(Char* arg)
 {
+   Char* pattern;
+
    if      VG_STR_CLO(arg, "--fnstart", clo_fnstart) {}
+   else if VG_STR_CLO(arg, "--trace-fn", pattern) {
+      if (clo_trace_fn_count == TRACE_FN_MAX)
+         VG_(tool_panic)("Too many --trace-fn options.");
+      clo_trace_fn[clo_trace_fn_count++] = pattern;
+   }
    else if VG_STR_CLO(arg, "--consumer", clo_consumer) {}
    else if VG_BOOL_CLO(arg, "--run-consumer", clo_run_consumer) {}
+   else if VG_BOOL_CLO(arg, "--batch", clo_batch) {}
+   else if VG_BOOL_CLO(arg, "--pc", clo_pc) {}
+   else if VG_BOOL_CLO(arg, "--toggle-events", clo_toggle_events) {}
+   else if VG_BOOL_CLO(arg, "--calls", clo_calls) {}
+   else if VG_BINT_CLO(arg, "--sample-on", clo_sample_on, 1, 1000000000000LL) {}
+   else if VG_BINT_CLO(arg, "--sample-off", clo_sample_off, 0, 1000000000000LL) {}
+   else if VG_XACT_CLO(arg, "--sample-unit=accesses",
+                       clo_sample_unit, SampleAccesses) {}
+   else if VG_XACT_CLO(arg, "--sample-unit=instrs",
+                       clo_sample_unit, SampleInstrs) {}
    else
       return False;
    
@@ -78,8 +128,17 @@ static void mt_print_usage(void)
 {  
    VG_(printf)(
 "    --fnstart=<name>        start tracing when entering this function [%s]\n"
+"    --trace-fn=<pattern>    trace only inside matching functions, with\n"
+"                            callees (wildcards * and ?, repeatable)\n"
 "    --consumer=<name>       event consumer binary to start [%s]\n"
-"    --run-consumer=yes|no   run consumer (use no for debugging) [yes]\n",
+"    --run-consumer=yes|no   run consumer (use no for debugging) [yes]\n"
+"    --batch=yes|no          send accesses of a superblock as one event [no]\n"
+"    --pc=yes|no             send instruction addresses of accesses [no]\n"
+"    --toggle-events=yes|no  send events when tracing is switched on/off [no]\n"
+"    --calls=yes|no          send function calls and returns [no]\n"
+"    --sample-on=<n>         with --sample-off, trace <n> units, then skip [0]\n"
+"    --sample-off=<m>        ... <m> units, alternating (0: no sampling) [0]\n"
+"    --sample-unit=accesses|instrs  unit for sampling intervals [accesses]\n",
 clo_fnstart, clo_consumer
    );
 }
@@ -95,12 +154,387 @@ static void mt_print_debug_usage(void)
 /*--- Stuff for --basic-counts                             ---*/
 /*------------------------------------------------------------*/
 
-static void start_tracing(void)
+static void free_batch_infos(void);
+
+static void print_trace_tid(void)
+{
+    if (last_trace_tid != last_seen_tid) {
+	last_trace_tid = last_seen_tid;
+
+	ev_run_tid* e;
+	e = (ev_run_tid*) write_event(&bridge_state, TR_RUN_TID,
+				      sizeof(ev_run_tid));
+	e->tid = last_trace_tid;
+    }
+}
+
+/* Code is only instrumented while tracing is on: switching discards
+ * all translations, so code runs without any helper calls outside of
+ * traced regions. */
+static void set_tracing(Bool on)
+{
+   ev_tracing* e;
+
+   if (on == mt_tracing_state) return;
+   mt_tracing_state = on;
+
+   VG_(discard_translations)( (Addr64)0x1000, (ULong) ~0xfffl, "mctracer" );
+   free_batch_infos();
+
+   if (clo_toggle_events) {
+      e = (ev_tracing*) write_event(&bridge_state, TR_TRACING, sizeof(ev_tracing));
+      e->on = on;
+   }
+}
+
+/* Start tracing at function specified with --fnstart (defaults to
+ * "main"). Called at its entry in untraced code: returns 1 if tracing
+ * was switched on, then the block exits to be retranslated. The code
+ * of the discarded block stays valid until then. */
+static UWord start_tracing(void)
+{
+   if (mt_tracing_state) return 0;
+   set_tracing(True);
+   return 1;
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Function windows (--trace-fn)                        ---*/
+/*------------------------------------------------------------*/
+
+#define FN_NAME_MAX 240
+
+/* Functions get ids starting at 1, announced to the consumer once
+ * with TR_FN_INFO. fn_names[id] is the name of function <id>. */
+static Char** fn_names = 0;
+static UInt   fn_names_size = 0;
+static UInt   fn_count = 0;
+
+/* Hash of names to ids, open addressing, at most half full */
+static UInt*  fn_hash = 0;
+static UInt   fn_hash_size = 0;
+
+static UInt str_hash(const Char* s)
+{
+   UInt h = 5381;
+
+   while (*s)
+      h = h * 33 + (UChar)*s++;
+   return h;
+}
+
+static void fn_hash_insert(UInt id)
+{
+   UInt i = str_hash(fn_names[id]) & (fn_hash_size - 1);
+
+   while (fn_hash[i])
+      i = (i + 1) & (fn_hash_size - 1);
+   fn_hash[i] = id;
+}
+
+/* Id of function <name>, sending TR_FN_INFO for new ones */
+static UInt fn_id(const Char* name)
+{
+   UInt i, id, len;
+   ev_fn_info* e;
+
+   if (fn_hash_size > 0) {
+      i = str_hash(name) & (fn_hash_size - 1);
+      while ((id = fn_hash[i]) != 0) {
+         if (VG_(strcmp)(fn_names[id], name) == 0) return id;
+         i = (i + 1) & (fn_hash_size - 1);
+      }
+   }
+
+   id = ++fn_count;
+   if (id >= fn_names_size) {
+      fn_names_size = fn_names_size ? 2 * fn_names_size : 256;
+      fn_names = VG_(realloc)("mt.fnnames", fn_names,
+                              fn_names_size * sizeof(Char*));
+   }
+   fn_names[id] = VG_(strdup)("mt.fnname", name);
+
+   if (2 * fn_count > fn_hash_size) {
+      if (fn_hash) VG_(free)(fn_hash);
+      fn_hash_size = fn_hash_size ? 2 * fn_hash_size : 512;
+      fn_hash = VG_(calloc)("mt.fnhash", fn_hash_size, sizeof(UInt));
+      for (i = 1; i < id; i++)
+         fn_hash_insert(i);
+   }
+   fn_hash_insert(id);
+
+   len = VG_(strlen)(name) + 1;
+   if (len > FN_NAME_MAX) len = FN_NAME_MAX;
+   e = (ev_fn_info*) write_event(&bridge_state, TR_FN_INFO, EV_FN_INFO_LEN(len));
+   e->id = id;
+   VG_(memcpy)(e->name, name, len);
+   e->name[len-1] = 0;
+   return id;
+}
+
+/* Per code address: id of the function starting there (only with
+ * --trace-fn or --calls, else 0), and whether it matches --trace-fn
+ * or --fnstart. Code is retranslated each time tracing is switched,
+ * so symbol lookup and pattern matching is done once per address. */
+typedef
+   struct {
+      Addr addr;
+      UInt fn;
+      Bool match;
+   }
+   FnEntry;
+
+static FnEntry* fn_entries = 0;
+static UInt     fn_entries_size = 0;
+static UInt     fn_entries_used = 0;
+
+static __inline__ UInt addr_hash(Addr a)
+{
+   return (UInt)(a ^ (a >> 13)) * 2654435761u;
+}
+
+static FnEntry* fn_entry_insert(Addr addr, UInt fn, Bool match)
+{
+   UInt i = addr_hash(addr) & (fn_entries_size - 1);
+
+   while (fn_entries[i].addr)
+      i = (i + 1) & (fn_entries_size - 1);
+   fn_entries[i].addr  = addr;
+   fn_entries[i].fn    = fn;
+   fn_entries[i].match = match;
+   return &fn_entries[i];
+}
+
+static FnEntry* fn_entry(Addr addr)
+{
+   Char     fnname[FN_NAME_MAX];
+   FnEntry* old;
+   UInt     i, fn = 0, old_size;
+   Bool     match = False;
+   Int      p;
+
+   if (fn_entries_size > 0) {
+      i = addr_hash(addr) & (fn_entries_size - 1);
+      while (fn_entries[i].addr) {
+         if (fn_entries[i].addr == addr) return &fn_entries[i];
+         i = (i + 1) & (fn_entries_size - 1);
+      }
+   }
+
+   if (VG_(get_fnname_if_entry)(addr, fnname, sizeof(fnname))) {
+      if (clo_trace_fn_count == 0)
+         match = (VG_(strcmp)(fnname, clo_fnstart) == 0);
+      else
+         for (p = 0; p < clo_trace_fn_count; p++)
+            if (VG_(string_match)(clo_trace_fn[p], fnname)) {
+               match = True;
+               break;
+            }
+      if ((match && clo_trace_fn_count > 0) || clo_calls)
+         fn = fn_id(fnname);
+   }
+
+   if (2 * (fn_entries_used + 1) > fn_entries_size) {
+      old = fn_entries;
+      old_size = fn_entries_size;
+      fn_entries_size = old_size ? 2 * old_size : 4096;
+      fn_entries = VG_(calloc)("mt.fnentries", fn_entries_size, sizeof(FnEntry));
+      for (i = 0; i < old_size; i++)
+         if (old[i].addr)
+            fn_entry_insert(old[i].addr, old[i].fn, old[i].match);
+      if (old) VG_(free)(old);
+   }
+   fn_entries_used++;
+   return fn_entry_insert(addr, fn, match);
+}
+
+/* Windows of a thread: matched functions it currently is in,
+ * innermost last. <sp> is the stack pointer at function entry.
+ * A window is left as soon as the stack pointer after a return is
+ * above <sp>: this also handles longjmp and exceptions, as the
+ * next return after unwinding closes all windows passed.
+ * Tracing is switched on at the first window entry and stays on
+ * afterwards (accesses outside of windows are dropped by in_window()):
+ * switching it off when the last window closes would discard all
+ * translations at every outermost entry and exit. */
+#define WINDOW_MAX 64
+
+typedef
+   struct {
+      UWord sp;
+      UInt  fn;
+   }
+   Window;
+
+typedef
+   struct {
+      Int    depth;
+      Window w[WINDOW_MAX];
+   }
+   ThreadWindows;
+
+static ThreadWindows* thread_windows[VG_N_THREADS];
+
+static __inline__ Bool in_window(void)
+{
+   return (last_seen_tid < VG_N_THREADS) &&
+          thread_windows[last_seen_tid] &&
+          (thread_windows[last_seen_tid]->depth > 0);
+}
+
+// leave windows entered with stack pointer below <sp>
+static void windows_leave(ThreadWindows* tw, UWord sp)
+{
+   ev_fn* e;
+
+   while (tw->depth > 0 && tw->w[tw->depth-1].sp < sp) {
+      tw->depth--;
+      print_trace_tid();
+      e = (ev_fn*) write_event(&bridge_state, TR_FN_LEAVE, sizeof(ev_fn));
+      e->id = tw->w[tw->depth].fn;
+   }
+}
+
+/* Entry of matched function <fn> with stack pointer <sp>.
+ * Returns 1 if tracing was switched on: the calling untraced block
+ * then exits to be retranslated, and the entry is seen again. */
+static VG_REGPARM(2) UWord fn_enter(UWord fn, UWord sp)
+{
+   ThreadWindows* tw;
+   Window* top;
+   ev_fn*  e;
+
+   if (last_seen_tid >= VG_N_THREADS) return 0;
+   tw = thread_windows[last_seen_tid];
+   if (!tw) {
+      tw = VG_(calloc)("mt.windows", 1, sizeof(ThreadWindows));
+      thread_windows[last_seen_tid] = tw;
+   }
+
+   // executed again after retranslation?
+   top = tw->depth > 0 ? &tw->w[tw->depth-1] : 0;
+   if (top && top->sp == sp && top->fn == fn) return 0;
+
+   // windows not left by a return, e.g. on tail calls
+   windows_leave(tw, sp + 1);
+
+   // deeper recursion is covered by the outer windows
+   if (tw->depth == WINDOW_MAX) return 0;
+   tw->w[tw->depth].sp = sp;
+   tw->w[tw->depth].fn = fn;
+   tw->depth++;
+
+   print_trace_tid();
+   e = (ev_fn*) write_event(&bridge_state, TR_FN_ENTER, sizeof(ev_fn));
+   e->id = fn;
+
+   if (mt_tracing_state) return 0;
+   set_tracing(True);
+   return 1;
+}
+
+/* After a return to stack pointer <sp> */
+static VG_REGPARM(1) void fn_return(UWord sp)
+{
+   ThreadWindows* tw;
+
+   if (last_seen_tid >= VG_N_THREADS) return;
+   tw = thread_windows[last_seen_tid];
+   if (!tw || tw->depth == 0) return;
+
+   windows_leave(tw, sp);
+}
+
+/* With --calls=yes: entries of all functions and returns, sent while
+ * accesses are traced. The consumer keeps shadow call stacks, using
+ * the stack pointers to find the calls finished by a return. */
+static VG_REGPARM(2) void trace_call(UWord fn, UWord sp)
+{
+   ev_call* e;
+
+   if (!mt_tracing_state) return;
+   if (clo_trace_fn_count > 0 && !in_window()) return;
+
+   print_trace_tid();
+   e = (ev_call*) write_event(&bridge_state, TR_CALL, sizeof(ev_call));
+   e->id = fn;
+   e->sp = sp;
+}
+
+static VG_REGPARM(1) void trace_return(UWord sp)
+{
+   ev_return* e;
+
+   if (!mt_tracing_state) return;
+   if (clo_trace_fn_count > 0 && !in_window()) return;
+
+   print_trace_tid();
+   e = (ev_return*) write_event(&bridge_state, TR_RETURN, sizeof(ev_return));
+   e->sp = sp;
+}
+
+
+/*------------------------------------------------------------*/
+/*--- Burst sampling                                       ---*/
+/*------------------------------------------------------------*/
+
+static UInt  sample_traced = 1;      // in traced interval? Loaded by guards
+static Long  sample_left = 0;        // units left in current interval
+static UInt  sample_interval = 0;    // number of traced intervals started
+static ULong sample_skipped = 0;     // accesses not sent in current interval
+
+// switch to next interval(s) after <n> units
+static void sample_advance(Long n)
 {
-   // start tracing at function specified with --fnstart (defaults to "main")
-   mt_tracing_state = True;
+   ev_sample* e;
+
+   sample_left -= n;
+   while (sample_left <= 0) {
+      sample_traced = !sample_traced;
+      if (sample_traced) {
+         sample_left += clo_sample_on;
+         sample_interval++;
+      }
+      else
+         sample_left += clo_sample_off;
+
+      e = (ev_sample*) write_event(&bridge_state, TR_SAMPLE, sizeof(ev_sample));
+      e->traced   = sample_traced;
+      e->interval = sample_interval;
+      e->skipped  = sample_skipped;
+      sample_skipped = 0;
+   }
 }
 
+/* Sampling for a superblock part with <instrs> guest instructions
+ * and <accesses> data accesses, called before the helpers of the
+ * accesses. These are guarded by sample_traced in the instrumented
+ * code: in intervals not traced, no helper is called per access. */
+static VG_REGPARM(2) void sample_part(UWord instrs, UWord accesses)
+{
+   Bool counted;
+
+   if (!mt_tracing_state) return;
+   counted = (clo_trace_fn_count == 0) || in_window();
+   if (clo_sample_unit == SampleInstrs)
+      sample_advance(instrs);
+   else if (counted)
+      sample_advance(accesses);
+   if (counted && !sample_traced)
+      sample_skipped += accesses;
+}
+
+// Should <n> accesses be sent? Sampling intervals are advanced by
+// sample_part(), only accesses not guarded are counted here
+static __inline__ Bool trace_accesses(Int n)
+{
+   if (!mt_tracing_state) return False;
+   if (clo_trace_fn_count > 0 && !in_window()) return False;
+   if (!sample_traced)
+      sample_skipped += n;
+   return sample_traced;
+}
 
 /*------------------------------------------------------------*/
 /*--- Stuff for memory access tracing                      ---*/
@@ -121,6 +555,7 @@ typedef
       EventKind  ekind;
       IRAtom*    addr;
       Int        size;
+      Addr       iaddr;  // guest instruction doing the access
    }
    Event;
 
@@ -130,6 +565,12 @@ typedef
    extending live ranges of address temporaries. */
 #define N_EVENTS 5
 
+/* With --batch=yes, the addresses of up to TR_DATA_MULTI_MAX accesses
+   are stored directly into batch_addr by the instrumented code, and
+   one helper call per flush writes them as a TR_DATA_MULTI event.
+   Ir events are not queued in this mode. */
+#define N_EVENTS_MAX TR_DATA_MULTI_MAX
+
 /* Maintain an ordered list of memory events which are outstanding, in
    the sense that no IR has yet been generated to do the relevant
    helper calls.  The SB is scanned top to bottom and memory events
@@ -156,27 +597,68 @@ typedef
    instrumentation IR for each event, in the order in which they
    appear. */
 
-static Event events[N_EVENTS];
+static Event events[N_EVENTS_MAX];
 static Int   events_used = 0;
 
-static ThreadId last_trace_tid = -1;
-static ThreadId last_seen_tid = -1;
+/* guest instructions since last flush, for sampling */
+static Int   instrs_unflushed = 0;
+static Int   events_limit = N_EVENTS;
 
-/* Event bridge writing state */
-static rb_state bridge_state;
+/* Static info of the accesses batched into one TR_DATA_MULTI event.
+ * Allocated at instrumentation time, passed to trace_multi().
+ * All are freed when tracing is switched, as all translations are
+ * discarded then. Others discarded by Valgrind (rare) are not freed. */
+typedef
+   struct _BatchInfo {
+      UChar count;
+      UInt  kinds;
+      UInt  pcs;
+      UChar len[TR_DATA_MULTI_MAX];
+      struct _BatchInfo* next;  // list of all allocated
+   }
+   BatchInfo;
 
-static void print_trace_tid(void)
+static BatchInfo* batch_infos = 0;
+
+static void free_batch_infos(void)
 {
-    if (last_trace_tid != last_seen_tid) {
-	last_trace_tid = last_seen_tid;
+   BatchInfo* bi;
 
-	ev_run_tid* e;
-	e = (ev_run_tid*) write_event(&bridge_state, TR_RUN_TID,
-				      sizeof(ev_run_tid));
-	e->tid = last_trace_tid;
-    }
+   while (batch_infos) {
+      bi = batch_infos;
+      batch_infos = bi->next;
+      VG_(free)(bi);
+   }
 }
 
+/* Filled by instrumented code before calling trace_multi().
+ * Only one guest thread runs at a time, and stores and helper call
+ * are in the same superblock, so one static buffer is enough */
+static Addr batch_addr[TR_DATA_MULTI_MAX];
+
+/* With --pc=yes, the instruction addresses of the accesses flushed
+ * together are sent once as TR_PC_TABLE at instrumentation time.
+ * Access events only refer to table id and index. Sent tables are
+ * kept in a hash table keyed by their contents: code is retranslated
+ * each time tracing is switched, and then refers to the table sent
+ * before instead of sending a new one. */
+typedef
+   struct {
+      UInt  id;      // 0: empty slot
+      UInt  hash;
+      Int   count;
+      Addr* pc;
+   }
+   PcTable;
+
+static PcTable* pc_tables = 0;
+static UInt     pc_tables_size = 0;
+static UInt     pc_tables_sent = 0;
+
+/* Address of the guest instruction currently instrumented */
+static Addr  current_iaddr = 0;
+
+
 static VG_REGPARM(2) void trace_instr(Addr addr, SizeT size)
 {
 //    VG_(printf)("I %08lx,%lu\n", addr, size);
@@ -184,7 +666,7 @@ static VG_REGPARM(2) void trace_instr(Addr addr, SizeT size)
 
 static VG_REGPARM(2) void trace_load(Addr addr, SizeT size)
 {
-    if (mt_tracing_state) {
+    if (trace_accesses(1)) {
 	print_trace_tid();
 	
 	ev_data_read* e;
@@ -197,7 +679,7 @@ static VG_REGPARM(2) void trace_load(Addr addr, SizeT size)
 
 static VG_REGPARM(2) void trace_store(Addr addr, SizeT size)
 {
-    if (mt_tracing_state) {
+    if (trace_accesses(1)) {
 	print_trace_tid();
 
 	ev_data_write* e;
@@ -208,16 +690,284 @@ static VG_REGPARM(2) void trace_store(Addr addr, SizeT size)
     }
 }
 
+/* <pcidx> is (PC table id << 8) | index in table */
+static VG_REGPARM(3) void trace_load_pc(Addr addr, SizeT size, UWord pcidx)
+{
+    if (trace_accesses(1)) {
+	print_trace_tid();
 
+	ev_data_read_pc* e;
+	e = (ev_data_read_pc*) write_event(&bridge_state, TR_DATA_READ_PC,
+					   sizeof(ev_data_read_pc));
+	e->addr = addr;
+	e->len  = size;
+	e->pcs  = pcidx >> 8;
+	e->idx  = pcidx & 0xff;
+    }
+}
 
-static void flushEvents(IRSB* sb)
+static VG_REGPARM(3) void trace_store_pc(Addr addr, SizeT size, UWord pcidx)
+{
+    if (trace_accesses(1)) {
+	print_trace_tid();
+
+	ev_data_write_pc* e;
+	e = (ev_data_write_pc*) write_event(&bridge_state, TR_DATA_WRITE_PC,
+					    sizeof(ev_data_write_pc));
+	e->addr = addr;
+	e->len  = size;
+	e->pcs  = pcidx >> 8;
+	e->idx  = pcidx & 0xff;
+    }
+}
+
+/* Accesses too large for TR_DATA_READ/TR_DATA_WRITE */
+static VG_REGPARM(2) void trace_load_range(Addr addr, SizeT size)
+{
+    if (trace_accesses(1)) {
+	print_trace_tid();
+
+	ev_data_range* e;
+	e = (ev_data_range*) write_event(&bridge_state, TR_DATA_RANGE,
+					 sizeof(ev_data_range));
+	e->addr  = addr;
+	e->len   = size;
+	e->write = 0;
+    }
+}
+
+static VG_REGPARM(2) void trace_store_range(Addr addr, SizeT size)
+{
+    if (trace_accesses(1)) {
+	print_trace_tid();
+
+	ev_data_range* e;
+	e = (ev_data_range*) write_event(&bridge_state, TR_DATA_RANGE,
+					 sizeof(ev_data_range));
+	e->addr  = addr;
+	e->len   = size;
+	e->write = 1;
+    }
+}
+
+static PcTable* pc_table_slot(UInt hash)
+{
+    UInt i = hash & (pc_tables_size - 1);
+
+    while (pc_tables[i].id)
+	i = (i + 1) & (pc_tables_size - 1);
+    return &pc_tables[i];
+}
+
+/* Send instruction addresses of outstanding data events as new
+ * PC table, return its id, or the id of the same table sent before.
+ * Called at instrumentation time, so the table always is received
+ * before any access referring to it. Returns 0 (accesses without
+ * instruction address) if no ids are left. */
+static UInt send_pc_table(void)
+{
+    Int i, n = 0;
+    UInt h = 0, j, old_size;
+    PcTable *old, *t;
+    ev_pc_table* e;
+    Addr pc[TR_DATA_MULTI_MAX];
+
+    for (i = 0; i < events_used; i++)
+	if (events[i].ekind != Event_Ir)
+	    pc[n++] = events[i].iaddr;
+    if (n == 0) return 0;
+
+    for (i = 0; i < n; i++)
+	h = h * 31 + addr_hash(pc[i]);
+    if (pc_tables_size > 0) {
+	j = h & (pc_tables_size - 1);
+	for (t = &pc_tables[j]; t->id; t = &pc_tables[j]) {
+	    if (t->hash == h && t->count == n &&
+		VG_(memcmp)(t->pc, pc, n * sizeof(Addr)) == 0)
+		return t->id;
+	    j = (j + 1) & (pc_tables_size - 1);
+	}
+    }
+    if (pc_tables_sent + 1 >= TR_PC_TABLES_MAX) return 0;
+
+    if (2 * (pc_tables_sent + 1) > pc_tables_size) {
+	old = pc_tables;
+	old_size = pc_tables_size;
+	pc_tables_size = old_size ? 2 * old_size : 4096;
+	pc_tables = VG_(calloc)("mt.pctables", pc_tables_size, sizeof(PcTable));
+	for (j = 0; j < old_size; j++)
+	    if (old[j].id)
+		*pc_table_slot(old[j].hash) = old[j];
+	if (old) VG_(free)(old);
+    }
+    t = pc_table_slot(h);
+    t->id    = ++pc_tables_sent;
+    t->hash  = h;
+    t->count = n;
+    t->pc    = VG_(malloc)("mt.pctable", n * sizeof(Addr));
+    VG_(memcpy)(t->pc, pc, n * sizeof(Addr));
+
+    e = (ev_pc_table*) write_event(&bridge_state, TR_PC_TABLE,
+				   EV_PC_TABLE_LEN(n));
+    e->id = t->id;
+    e->count = n;
+    for (i = 0; i < n; i++)
+	e->pc[i] = pc[i];
+
+    return e->id;
+}
+
+static void send_exe_info(void)
+{
+    UInt len;
+    ev_exe_info* e;
+
+    len = VG_(strlen)(VG_(args_the_exename)) + 1;
+    if (len > sizeof(e->path)) return;
+
+    e = (ev_exe_info*) write_event(&bridge_state, TR_EXE_INFO, len);
+    VG_(memcpy)(e->path, VG_(args_the_exename), len);
+}
+
+/* Send code segments of all loaded objects, for symbolization of
+ * the instruction addresses in PC tables by the consumer. Done once
+ * at exit: only instructions reported by the consumer need names. */
+static void send_obj_infos(void)
+{
+    const DebugInfo* di;
+    const UChar* path;
+    UInt len;
+    ev_obj_info* e;
+
+    for (di = VG_(next_DebugInfo)(0); di; di = VG_(next_DebugInfo)(di)) {
+	path = VG_(DebugInfo_get_filename)(di);
+	if (!path || VG_(DebugInfo_get_text_size)(di) == 0) continue;
+	len = VG_(strlen)((const Char*)path) + 1;
+	if (len > sizeof(e->path)) continue;
+
+	e = (ev_obj_info*) write_event(&bridge_state, TR_OBJ_INFO,
+				       EV_OBJ_INFO_LEN(len));
+	e->avma = VG_(DebugInfo_get_text_avma)(di);
+	e->size = VG_(DebugInfo_get_text_size)(di);
+	e->bias = (Addr) VG_(DebugInfo_get_text_bias)(di);
+	VG_(memcpy)(e->path, path, len);
+    }
+}
+
+static VG_REGPARM(1) void trace_multi(BatchInfo* bi)
+{
+    if (trace_accesses(bi->count)) {
+	Int i;
+	print_trace_tid();
+
+	ev_data_multi* e;
+	e = (ev_data_multi*) write_event(&bridge_state, TR_DATA_MULTI,
+					 EV_DATA_MULTI_LEN(bi->count));
+	e->count = bi->count;
+	e->kinds = bi->kinds;
+	e->pcs   = bi->pcs;
+	for (i = 0; i < bi->count; i++) {
+	    e->len[i]  = bi->len[i];
+	    e->addr[i] = batch_addr[i];
+	}
+    }
+}
+
+/* With sampling: is the current interval traced? Loaded by the
+ * instrumented code, as guard for the helper calls of accesses */
+static IRExpr* sampleGuard(IRSB* sb)
+{
+   IRTemp traced = newIRTemp(sb->tyenv, Ity_I32);
+   IRTemp guard  = newIRTemp(sb->tyenv, Ity_I1);
+
+   addStmtToIRSB( sb, IRStmt_WrTmp( traced,
+                     IRExpr_Load( Iend_LE, Ity_I32,
+                                  mkIRExpr_HWord( (HWord)&sample_traced ) ) ) );
+   addStmtToIRSB( sb, IRStmt_WrTmp( guard,
+                     IRExpr_Binop( Iop_CmpNE32, IRExpr_RdTmp(traced),
+                                   IRExpr_Const( IRConst_U32(0) ) ) ) );
+   return IRExpr_RdTmp(guard);
+}
+
+/* Call sample_part() for <instrs> guest instructions and <accesses>
+ * data accesses, return the guard for the helpers of the accesses
+ * (0 if there are none) */
+static IRExpr* addSamplePart(IRSB* sb, Int instrs, Int accesses)
+{
+   IRDirty* di;
+
+   if (instrs > 0 || accesses > 0) {
+      di = unsafeIRDirty_0_N( /*regparms*/2,
+                              "sample_part",
+                              VG_(fnptr_to_fnentry)( sample_part ),
+                              mkIRExprVec_2( mkIRExpr_HWord( instrs ),
+                                             mkIRExpr_HWord( accesses ) ) );
+      // the load of the guard below must not be moved before
+      di->mFx   = Ifx_Modify;
+      di->mAddr = mkIRExpr_HWord( (HWord)&sample_traced );
+      di->mSize = sizeof(sample_traced);
+      addStmtToIRSB( sb, IRStmt_Dirty(di) );
+   }
+   return (accesses > 0) ? sampleGuard(sb) : 0;
+}
+
+static void flushEvents_batch(IRSB* sb, IRExpr* guard)
 {
    Int        i;
+   IRDirty*   di;
+   BatchInfo* bi;
+
+   if (events_used == 0) return;
+
+   bi = VG_(malloc)("mt.batchinfo", sizeof(BatchInfo));
+   bi->next  = batch_infos;
+   batch_infos = bi;
+   bi->count = events_used;
+   bi->kinds = 0;
+   bi->pcs   = clo_pc ? send_pc_table() : 0;
+   for (i = 0; i < events_used; i++) {
+      tl_assert(events[i].ekind != Event_Ir);
+      if (events[i].ekind == Event_Dw)
+         bi->kinds |= 1u << i;
+      bi->len[i] = events[i].size;
+   }
+
+   di = unsafeIRDirty_0_N( /*regparms*/1,
+                           "trace_multi", VG_(fnptr_to_fnentry)( trace_multi ),
+                           mkIRExprVec_1( mkIRExpr_HWord( (HWord)bi ) ) );
+   if (guard) di->guard = guard;
+   addStmtToIRSB( sb, IRStmt_Dirty(di) );
+
+   events_used = 0;
+}
+
+static void flushEvents(IRSB* sb)
+{
+   Int        i, regparms;
    Char*      helperName;
    void*      helperAddr;
    IRExpr**   argv;
    IRDirty*   di;
    Event*     ev;
+   IRExpr*    guard = 0;
+   UInt       pcs = 0, pcidx = 0;
+   Int        accesses = 0;
+
+   if (clo_sample_off > 0) {
+      for (i = 0; i < events_used; i++)
+         if (events[i].ekind != Event_Ir)
+            accesses++;
+      guard = addSamplePart(sb, instrs_unflushed, accesses);
+   }
+   instrs_unflushed = 0;
+
+   if (clo_batch) {
+      flushEvents_batch(sb, guard);
+      return;
+   }
+
+   if (clo_pc)
+      pcs = send_pc_table();
 
    for (i = 0; i < events_used; i++) {
 
@@ -238,11 +988,31 @@ static void flushEvents(IRSB* sb)
             tl_assert(0);
       }
 
+      // Accesses with PC table refer to their index in that table
+      if (pcs && ev->ekind != Event_Ir) {
+         if (ev->ekind == Event_Dr) {
+            helperName = "trace_load_pc";
+            helperAddr =  trace_load_pc;
+         }
+         else {
+            helperName = "trace_store_pc";
+            helperAddr =  trace_store_pc;
+         }
+         argv = mkIRExprVec_3( ev->addr, mkIRExpr_HWord( ev->size ),
+                               mkIRExpr_HWord( ((HWord)pcs << 8) | pcidx ) );
+         regparms = 3;
+         pcidx++;
+      }
+      else {
+         argv = mkIRExprVec_2( ev->addr, mkIRExpr_HWord( ev->size ) );
+         regparms = 2;
+      }
+
       // Add the helper.
-      argv = mkIRExprVec_2( ev->addr, mkIRExpr_HWord( ev->size ) );
-      di   = unsafeIRDirty_0_N( /*regparms*/2, 
+      di   = unsafeIRDirty_0_N( regparms,
                                 helperName, VG_(fnptr_to_fnentry)( helperAddr ),
                                 argv );
+      if (guard && ev->ekind != Event_Ir) di->guard = guard;
       addStmtToIRSB( sb, IRStmt_Dirty(di) );
    }
 
@@ -259,9 +1029,11 @@ static void addEvent_Ir ( IRSB* sb, IRAtom* iaddr, UInt isize )
    Event* evt;
    tl_assert( (VG_MIN_INSTR_SZB <= isize && isize <= VG_MAX_INSTR_SZB)
             || VG_CLREQ_SZB == isize );
-   if (events_used == N_EVENTS)
+   if (clo_batch)
+      return;
+   if (events_used == events_limit)
       flushEvents(sb);
-   tl_assert(events_used >= 0 && events_used < N_EVENTS);
+   tl_assert(events_used >= 0 && events_used < events_limit);
    evt = &events[events_used];
    evt->ekind = Event_Ir;
    evt->addr  = iaddr;
@@ -269,19 +1041,60 @@ static void addEvent_Ir ( IRSB* sb, IRAtom* iaddr, UInt isize )
    events_used++;
 }
 
+// With --batch=yes, store the address of a new event into its slot of
+// batch_addr right away. This keeps the live range of the address
+// temporary short even with many outstanding events.
+static void addBatchStore ( IRSB* sb, Event* evt )
+{
+   if (!clo_batch) return;
+   addStmtToIRSB( sb, IRStmt_Store( Iend_LE, /* x86/amd64 host */
+                                    mkIRExpr_HWord( (HWord)&batch_addr[events_used] ),
+                                    evt->addr ) );
+}
+
+// Accesses larger than TR_DATA_LEN_MAX are not queued, but sent
+// as TR_DATA_RANGE right away, after all outstanding events
+static
+void addEvent_Drange ( IRSB* sb, IRAtom* daddr, Int dsize, Bool write )
+{
+   IRDirty* di;
+   IRExpr*  guard = 0;
+
+   flushEvents(sb);
+   // counted as one access for sampling
+   if (clo_sample_off > 0)
+      guard = addSamplePart(sb, 0, 1);
+   if (write)
+      di = unsafeIRDirty_0_N( /*regparms*/2,
+                              "trace_store_range", VG_(fnptr_to_fnentry)( trace_store_range ),
+                              mkIRExprVec_2( daddr, mkIRExpr_HWord( dsize ) ) );
+   else
+      di = unsafeIRDirty_0_N( /*regparms*/2,
+                              "trace_load_range", VG_(fnptr_to_fnentry)( trace_load_range ),
+                              mkIRExprVec_2( daddr, mkIRExpr_HWord( dsize ) ) );
+   if (guard) di->guard = guard;
+   addStmtToIRSB( sb, IRStmt_Dirty(di) );
+}
+
 static
 void addEvent_Dr ( IRSB* sb, IRAtom* daddr, Int dsize )
 {
    Event* evt;
    tl_assert(isIRAtom(daddr));
    tl_assert(dsize >= 1 && dsize <= MAX_DSIZE);
-   if (events_used == N_EVENTS)
+   if (dsize > TR_DATA_LEN_MAX) {
+      addEvent_Drange(sb, daddr, dsize, False);
+      return;
+   }
+   if (events_used == events_limit)
       flushEvents(sb);
-   tl_assert(events_used >= 0 && events_used < N_EVENTS);
+   tl_assert(events_used >= 0 && events_used < events_limit);
    evt = &events[events_used];
    evt->ekind = Event_Dr;
    evt->addr  = daddr;
    evt->size  = dsize;
+   evt->iaddr = current_iaddr;
+   addBatchStore(sb, evt);
    events_used++;
 }
 
@@ -291,14 +1104,20 @@ void addEvent_Dw ( IRSB* sb, IRAtom* daddr, Int dsize )
    Event* evt;
    tl_assert(isIRAtom(daddr));
    tl_assert(dsize >= 1 && dsize <= MAX_DSIZE);
+   if (dsize > TR_DATA_LEN_MAX) {
+      addEvent_Drange(sb, daddr, dsize, True);
+      return;
+   }
 
-   if (events_used == N_EVENTS)
+   if (events_used == events_limit)
       flushEvents(sb);
-   tl_assert(events_used >= 0 && events_used < N_EVENTS);
+   tl_assert(events_used >= 0 && events_used < events_limit);
    evt = &events[events_used];
    evt->ekind = Event_Dw;
    evt->size  = dsize;
    evt->addr  = daddr;
+   evt->iaddr = current_iaddr;
+   addBatchStore(sb, evt);
    events_used++;
 }
 
@@ -320,6 +1139,7 @@ Bool mt_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
    ev_simplesim_define_data* e;
    ev_simplesim_change_section* change_e;
    ev_simplesim_configure* configure_e;
+   ev_simplesim_pop_section* pop_e;
    int i;
    switch(args[0]) {
    case VG_USERREQ__PRINT:
@@ -347,7 +1167,10 @@ Bool mt_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
        break;
 
    case VG_USERREQ__TRACING:
-       mt_tracing_state = (Bool) args[1];
+       // client requests end a block, so translations can be discarded.
+       // With --trace-fn, only function windows switch tracing
+       if (clo_trace_fn_count == 0)
+          set_tracing( args[1] ? True : False );
        *ret = 0;                 /* meaningless */
        break;
 
@@ -385,7 +1208,10 @@ Bool mt_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
        break;
 
    case VG_USERREQ__SIMPLESIM_CHANGE_SECTION:
-       change_e = (ev_simplesim_change_section*) write_event(&bridge_state, TR_SIMPLESIM_CHANGE_SECTION,
+   case VG_USERREQ__SIMPLESIM_PUSH_SECTION:
+       change_e = (ev_simplesim_change_section*) write_event(&bridge_state,
+                  (args[0] == VG_USERREQ__SIMPLESIM_PUSH_SECTION) ?
+                  TR_SIMPLESIM_PUSH_SECTION : TR_SIMPLESIM_CHANGE_SECTION,
                   sizeof(ev_simplesim_change_section));
        change_e->id = (unsigned int) args[1];
        for(i=0;i<64;++i)
@@ -399,6 +1225,13 @@ Bool mt_handle_client_request(ThreadId tid, UWord *args, UWord *ret)
 		}
        *ret = 0;
        break;
+
+   case VG_USERREQ__SIMPLESIM_POP_SECTION:
+       pop_e = (ev_simplesim_pop_section*) write_event(&bridge_state, TR_SIMPLESIM_POP_SECTION,
+                  sizeof(ev_simplesim_pop_section));
+       pop_e->id = (unsigned int) args[1];
+       *ret = 0;
+       break;
    default:
       return False;
    }
@@ -418,7 +1251,15 @@ static void mt_start_client_code_callback ( ThreadId tid, ULong blocks_done )
 
 static void mt_post_clo_init(void)
 {
-   mt_tracing_state = (clo_fnstart[0] == 0);
+   mt_tracing_state = (clo_trace_fn_count == 0) && (clo_fnstart[0] == 0);
+   if (clo_sample_off > 0) {
+      if (clo_sample_on == 0)
+         VG_(tool_panic)("--sample-off needs --sample-on.");
+      sample_left = clo_sample_on;
+      sample_interval = 1;
+   }
+   if (clo_batch)
+      events_limit = N_EVENTS_MAX;
 
    shm_init();
    shm_rb* rb = shm_alloc_rb("tr_main", 4, 8192);
@@ -427,6 +1268,145 @@ static void mt_post_clo_init(void)
    shm_init_sending(&bridge_state, rb);
    shm_initialized();
    shm_startconsumer(clo_consumer, clo_run_consumer);
+
+   send_exe_info();
+   if (clo_toggle_events && mt_tracing_state) {
+      ev_tracing* e;
+      e = (ev_tracing*) write_event(&bridge_state, TR_TRACING, sizeof(ev_tracing));
+      e->on = True;
+   }
+}
+
+/* Exit to instruction at <iaddr> for retranslation if helper result
+ * <started> is not 0, i.e. tracing was switched on */
+static void addRetranslateExit ( IRSB* sb, IRTemp started, Addr iaddr,
+                                 IRType gWordTy )
+{
+   addStmtToIRSB( sb, IRStmt_Exit(
+                         IRExpr_Binop( gWordTy == Ity_I64 ? Iop_CmpNE64 : Iop_CmpNE32,
+                                       IRExpr_RdTmp(started), mkIRExpr_HWord(0) ),
+                         Ijk_Boring,
+                         gWordTy == Ity_I64 ? IRConst_U64(iaddr) : IRConst_U32(iaddr) ) );
+}
+
+/* Check for entry of the --fnstart function before instruction at
+ * <iaddr>, exiting to it for retranslation if tracing was started */
+static void addStartTracing ( IRSB* sb, Addr iaddr, IRType gWordTy )
+{
+   IRTemp   started = newIRTemp(sb->tyenv, gWordTy);
+   IRDirty* di;
+
+   di = unsafeIRDirty_1_N( started, 0, "start_tracing",
+                           VG_(fnptr_to_fnentry)( &start_tracing ),
+                           mkIRExprVec_0() );
+   addStmtToIRSB( sb, IRStmt_Dirty(di) );
+   addRetranslateExit( sb, started, iaddr, gWordTy );
+}
+
+/* Current guest stack pointer, as new temporary */
+static IRExpr* getSP ( IRSB* sb, VexGuestLayout* layout, IRType gWordTy )
+{
+   IRTemp sp = newIRTemp(sb->tyenv, gWordTy);
+
+   addStmtToIRSB( sb, IRStmt_WrTmp(sp, IRExpr_Get(layout->offset_SP, gWordTy)) );
+   return IRExpr_RdTmp(sp);
+}
+
+/* Entry of function <fn> matched by --trace-fn at <iaddr>. In untraced
+ * code, exit for retranslation if this switched tracing on */
+static void addFnEnter ( IRSB* sb, UInt fn, Addr iaddr, Bool untraced,
+                         VexGuestLayout* layout, IRType gWordTy )
+{
+   IRExpr** argv = mkIRExprVec_2( mkIRExpr_HWord(fn),
+                                  getSP(sb, layout, gWordTy) );
+   IRTemp   started;
+   IRDirty* di;
+
+   if (!untraced) {
+      di = unsafeIRDirty_0_N( 2, "fn_enter",
+                              VG_(fnptr_to_fnentry)( &fn_enter ), argv );
+      addStmtToIRSB( sb, IRStmt_Dirty(di) );
+      return;
+   }
+   started = newIRTemp(sb->tyenv, gWordTy);
+   di = unsafeIRDirty_1_N( started, 2, "fn_enter",
+                           VG_(fnptr_to_fnentry)( &fn_enter ), argv );
+   addStmtToIRSB( sb, IRStmt_Dirty(di) );
+   addRetranslateExit( sb, started, iaddr, gWordTy );
+}
+
+/* Call of function <fn> at its entry, with --calls=yes */
+static void addCall ( IRSB* sb, UInt fn, VexGuestLayout* layout,
+                      IRType gWordTy )
+{
+   IRDirty* di;
+
+   di = unsafeIRDirty_0_N( 2, "trace_call",
+                           VG_(fnptr_to_fnentry)( &trace_call ),
+                           mkIRExprVec_2( mkIRExpr_HWord(fn),
+                                          getSP(sb, layout, gWordTy) ) );
+   addStmtToIRSB( sb, IRStmt_Dirty(di) );
+}
+
+/* At the end of a superblock returning from a function */
+static void addReturn ( IRSB* sb, VexGuestLayout* layout, IRType gWordTy )
+{
+   IRExpr*  sp = getSP(sb, layout, gWordTy);
+   IRDirty* di;
+
+   if (clo_calls) {
+      di = unsafeIRDirty_0_N( 1, "trace_return",
+                              VG_(fnptr_to_fnentry)( &trace_return ),
+                              mkIRExprVec_1( sp ) );
+      addStmtToIRSB( sb, IRStmt_Dirty(di) );
+   }
+   if (clo_trace_fn_count > 0) {
+      di = unsafeIRDirty_0_N( 1, "fn_return",
+                              VG_(fnptr_to_fnentry)( &fn_return ),
+                              mkIRExprVec_1( sp ) );
+      addStmtToIRSB( sb, IRStmt_Dirty(di) );
+   }
+}
+
+/* Outside of traced regions, code only is checked for the entry of
+ * the --fnstart function or the functions matched by --trace-fn */
+static IRSB* mt_instrument_untraced ( IRSB* sbIn, VexGuestLayout* layout,
+                                      IRType gWordTy )
+{
+   Int      i;
+   FnEntry* fe;
+   IRSB*    sbOut;
+   IRStmt*  st;
+
+   if (!clo_fnstart[0] && clo_trace_fn_count == 0)
+      return sbIn;
+
+   sbOut = deepCopyIRSBExceptStmts(sbIn);
+   for (i = 0; i < sbIn->stmts_used; i++) {
+      st = sbIn->stmts[i];
+      if (!st || st->tag == Ist_NoOp) continue;
+      addStmtToIRSB( sbOut, st );
+
+      /* An unconditional branch to a known destination in the
+       * guest's instructions can be represented, in the IRSB to
+       * instrument, by the VEX statements that are the
+       * translation of that known destination. This feature is
+       * called 'SB chasing' and can be influenced by command
+       * line option --vex-guest-chase-thresh.
+       *
+       * To not miss the entry of the --fnstart function, taking SB
+       * chasing into account, we need to check for each guest
+       * instruction (Ist_IMark) if it is the entry point of a function.
+       */
+      if (st->tag != Ist_IMark) continue;
+      fe = fn_entry(st->Ist.IMark.addr);
+      if (!fe->match) continue;
+      if (clo_trace_fn_count > 0)
+         addFnEnter( sbOut, fe->fn, st->Ist.IMark.addr, True, layout, gWordTy );
+      else
+         addStartTracing( sbOut, st->Ist.IMark.addr, gWordTy );
+   }
+   return sbOut;
 }
 
 static
@@ -436,10 +1416,9 @@ IRSB* mt_instrument ( VgCallbackClosure* closure,
                       VexGuestExtents* vge,
                       IRType gWordTy, IRType hWordTy )
 {
-   IRDirty*   di;
    Int        i;
+   FnEntry*   fe;
    IRSB*      sbOut;
-   Char       fnname[100];
    IRTypeEnv* tyenv = sbIn->tyenv;
 
    if (gWordTy != hWordTy) {
@@ -447,6 +1426,9 @@ IRSB* mt_instrument ( VgCallbackClosure* closure,
       VG_(tool_panic)("host/guest word size mismatch");
    }
 
+   if (!mt_tracing_state)
+      return mt_instrument_untraced( sbIn, layout, gWordTy );
+
    /* Set up SB */
    sbOut = deepCopyIRSBExceptStmts(sbIn);
 
@@ -458,6 +1440,7 @@ IRSB* mt_instrument ( VgCallbackClosure* closure,
    }
 
    events_used = 0;
+   instrs_unflushed = 0;
 
    for (/*use current i*/; i < sbIn->stmts_used; i++) {
       IRStmt* st = sbIn->stmts[i];
@@ -473,30 +1456,22 @@ IRSB* mt_instrument ( VgCallbackClosure* closure,
 	     break;
 
          case Ist_IMark:
-
-	     /* An unconditional branch to a known destination in the
-	      * guest's instructions can be represented, in the IRSB to
-	      * instrument, by the VEX statements that are the
-	      * translation of that known destination. This feature is
-	      * called 'SB chasing' and can be influenced by command
-	      * line option --vex-guest-chase-thresh.
-	      *
-	      * To get an accurate count of the calls to a specific
-	      * function, taking SB chasing into account, we need to
-	      * check for each guest instruction (Ist_IMark) if it is
-	      * the entry point of a function.
-	      */
-	     tl_assert(clo_fnstart);
-	     if (clo_fnstart[0] &&
-		 VG_(get_fnname_if_entry)(st->Ist.IMark.addr, 
-					  fnname, sizeof(fnname))
-		 && 0 == VG_(strcmp)(fnname, clo_fnstart)) {
-		 di = unsafeIRDirty_0_N( 
-		     0, "start_tracing", 
-		     VG_(fnptr_to_fnentry)( &start_tracing ),
-		     mkIRExprVec_0() );
-		 addStmtToIRSB( sbOut, IRStmt_Dirty(di) );
+	     current_iaddr = st->Ist.IMark.addr;
+
+	     // function windows and calls: accesses before the entry
+	     // belong to the caller
+	     if (clo_trace_fn_count > 0 || clo_calls) {
+		 fe = fn_entry(current_iaddr);
+		 if (fe->fn) {
+		     flushEvents(sbOut);
+		     if (fe->match && clo_trace_fn_count > 0)
+			 addFnEnter( sbOut, fe->fn, current_iaddr, False,
+				     layout, gWordTy );
+		     if (clo_calls)
+			 addCall( sbOut, fe->fn, layout, gWordTy );
+		 }
 	     }
+	     instrs_unflushed++;
 
 	     // WARNING: do not remove this function call, even if you
 	     // aren't interested in instruction reads.  See the comment
@@ -584,11 +1559,25 @@ IRSB* mt_instrument ( VgCallbackClosure* closure,
    /* At the end of the sbIn.  Flush outstandings. */
    flushEvents(sbOut);
 
+   if ((clo_trace_fn_count > 0 || clo_calls) && sbIn->jumpkind == Ijk_Ret)
+      addReturn( sbOut, layout, gWordTy );
+
    return sbOut;
 }
 
 static void mt_fini(Int exitcode)
 {
+    ev_sample* e;
+
+    // report accesses skipped in the last interval
+    if (sample_skipped > 0) {
+	e = (ev_sample*) write_event(&bridge_state, TR_SAMPLE, sizeof(ev_sample));
+	e->traced   = 0;
+	e->interval = sample_interval;
+	e->skipped  = sample_skipped;
+    }
+    if (clo_pc)
+	send_obj_infos();
     shm_close(&bridge_state);
     shm_finish();
 }
@@ -14,6 +14,33 @@
 #define TR_SIMPLESIM_DEFINE_DATA 4
 #define TR_SIMPLESIM_CHANGE_SECTION 5
 #define TR_SIMPLESIM_CONFIGURE 6
+#define TR_DATA_MULTI        7
+#define TR_PC_TABLE          8
+#define TR_DATA_READ_PC      9
+#define TR_DATA_WRITE_PC    10
+#define TR_EXE_INFO         11
+#define TR_SAMPLE           12
+#define TR_SIMPLESIM_PUSH_SECTION 13
+#define TR_SIMPLESIM_POP_SECTION  14
+#define TR_DATA_RANGE       15
+#define TR_TRACING          16
+#define TR_FN_INFO          17
+#define TR_FN_ENTER         18
+#define TR_FN_LEAVE         19
+#define TR_CALL             20
+#define TR_RETURN           21
+#define TR_OBJ_INFO         22
+
+/* larger accesses do not fit into <len> of TR_DATA_READ/TR_DATA_WRITE,
+ * and are sent as TR_DATA_RANGE */
+#define TR_DATA_LEN_MAX     127
+
+/* max. number of accesses in one TR_DATA_MULTI event */
+#define TR_DATA_MULTI_MAX   24
+
+/* TR_PC_TABLE ids are below this; accesses of later code parts are
+ * sent without instruction address */
+#define TR_PC_TABLES_MAX    (1 << 22)
 
 typedef struct _tr_event tr_event;
 
@@ -50,12 +77,153 @@ typedef struct {
   char description[64];
 } ev_simplesim_change_section;
 
+// tag TR_SIMPLESIM_PUSH_SECTION uses ev_simplesim_change_section:
+// section #id becomes active, nested into the active one
+
+// tag TR_SIMPLESIM_POP_SECTION
+// leave section #id, the enclosing section becomes active again
+typedef struct {
+  unsigned int id;
+} ev_simplesim_pop_section;
+
 // tag TR_SIMPLESIM_CONFIGURE
 typedef struct {
   char setting[64];
   int value;
 } ev_simplesim_configure;
 
+// tag TR_DATA_MULTI
+// Accesses of one superblock, sent with --batch=yes.
+// Access i is a write if bit i in <kinds> is set, a read otherwise.
+// Only <count> entries of <addr> are sent (see EV_DATA_MULTI_LEN).
+// With --pc=yes, <pcs> is the id of the TR_PC_TABLE holding the
+// instruction address of access i at index i, otherwise 0.
+typedef struct {
+  unsigned char count;
+  unsigned int kinds;
+  unsigned int pcs;
+  unsigned char len[TR_DATA_MULTI_MAX];
+  Addr addr[TR_DATA_MULTI_MAX];
+} ev_data_multi;
+
+#define EV_DATA_MULTI_LEN(n) \
+  (sizeof(ev_data_multi) - (TR_DATA_MULTI_MAX - (n)) * sizeof(Addr))
+
+// tag TR_PC_TABLE
+// Instruction addresses of the accesses in a part of a superblock,
+// sent once at instrumentation time with --pc=yes. Retranslated code
+// refers to the table already sent. <id> is below TR_PC_TABLES_MAX.
+typedef struct {
+  unsigned int id;
+  unsigned char count;
+  Addr pc[TR_DATA_MULTI_MAX];
+} ev_pc_table;
+
+#define EV_PC_TABLE_LEN(n) \
+  (sizeof(ev_pc_table) - (TR_DATA_MULTI_MAX - (n)) * sizeof(Addr))
+
+// tag TR_DATA_READ_PC
+// instruction address is entry <idx> of TR_PC_TABLE <pcs>
+typedef struct {
+  Addr addr;
+  char len;
+  unsigned int pcs;
+  unsigned char idx;
+} ev_data_read_pc;
+
+// tag TR_DATA_WRITE_PC
+typedef struct {
+  Addr addr;
+  char len;
+  unsigned int pcs;
+  unsigned char idx;
+} ev_data_write_pc;
+
+// tag TR_EXE_INFO
+// path of the client executable as started, e.g. for reports.
+// Only the string including the terminating zero is sent.
+typedef struct {
+  char path[240];
+} ev_exe_info;
+
+// tag TR_SAMPLE
+// Interval boundary with --sample-on/--sample-off.
+// <traced> is 1 if a traced interval starts, 0 if accesses are not
+// sent until the next TR_SAMPLE. <skipped> gives the number of
+// accesses not sent in the interval just ended.
+typedef struct {
+  unsigned char traced;
+  unsigned int interval;
+  unsigned long long skipped;
+} ev_sample;
+
+// tag TR_DATA_RANGE
+// Access to <len> bytes from <addr>, e.g. by dirty helpers saving
+// processor state. A write if <write> is 1, a read otherwise.
+typedef struct {
+  Addr addr;
+  unsigned int len;
+  unsigned char write;
+} ev_data_range;
+
+// tag TR_TRACING
+// Tracing switched on (<on> is 1) or off, with --toggle-events=yes.
+// Also sent at start if tracing is on from the beginning.
+typedef struct {
+  unsigned char on;
+} ev_tracing;
+
+// tag TR_FN_INFO
+// Name of function <id>, sent once before the id is used.
+// Only the string including the terminating zero is sent
+// (see EV_FN_INFO_LEN).
+typedef struct {
+  unsigned int id;
+  char name[240];
+} ev_fn_info;
+
+#define EV_FN_INFO_LEN(n) \
+  (sizeof(ev_fn_info) - 240 + (n))
+
+// tags TR_FN_ENTER, TR_FN_LEAVE
+// The current thread entered/left a window of function <id>,
+// with --trace-fn. Windows nest as function calls do.
+typedef struct {
+  unsigned int id;
+} ev_fn;
+
+// tag TR_CALL
+// Entry of function <id> by the current thread, with stack pointer
+// <sp> at entry. Sent with --calls=yes.
+typedef struct {
+  unsigned int id;
+  Addr sp;
+} ev_call;
+
+// tag TR_RETURN
+// Return of the current thread to stack pointer <sp>: all calls
+// entered with a lower stack pointer are finished (this includes
+// calls left by longjmp or exceptions). Sent with --calls=yes.
+typedef struct {
+  Addr sp;
+} ev_return;
+
+// tag TR_OBJ_INFO
+// Code of a loaded object (executable or shared library), for
+// symbolization of instruction addresses by the consumer: address <a>
+// in [avma, avma+size) is at <a - bias> in file <path>. Sent at exit
+// with --pc=yes, for all objects still loaded. Only the string
+// including the terminating zero is sent (see EV_OBJ_INFO_LEN).
+typedef struct {
+  Addr avma;
+  Addr size;
+  Addr bias;
+  char path[224];
+} ev_obj_info;
+
+#define EV_OBJ_INFO_LEN(n) \
+  (sizeof(ev_obj_info) - 224 + (n))
+
 struct _tr_event {
   /* Event header */
   unsigned char len;
@@ -67,6 +235,20 @@ struct _tr_event {
     ev_simplesim_define_data simplesim_define_data;
 		ev_simplesim_change_section simplesim_change_section;
 		ev_simplesim_configure simplesim_configure;
+		ev_simplesim_pop_section simplesim_pop_section;
+    ev_data_multi  data_multi;
+    ev_pc_table    pc_table;
+    ev_data_read_pc  data_read_pc;
+    ev_data_write_pc data_write_pc;
+    ev_exe_info    exe_info;
+    ev_sample      sample;
+    ev_data_range  data_range;
+    ev_tracing     tracing;
+    ev_fn_info     fn_info;
+    ev_fn          fn;
+    ev_call        call;
+    ev_return      ret;
+    ev_obj_info    obj_info;
   };
 };
 #pragma pack(pop)
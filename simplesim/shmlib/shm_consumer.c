@@ -6,6 +6,7 @@
 
 #include "shm_consumer.h"
 #include "shm_common.h"
+#include "shm_import.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -18,9 +19,16 @@
 #include <assert.h>
 #include <stdarg.h>
 
+/* Trace file import (shm_import.c) is optional: consumers linked
+ * without it only attach to a running McTracer */
+#pragma weak import_open
+#pragma weak import_fill
+#pragma weak import_close
+
 struct _shm_buf {
     shm_header* h;
     char file[20];
+    shm_import* import; /* reading from trace file if set */
 };
 
 struct _rb_chunk {
@@ -35,6 +43,7 @@ struct _rb_chunk {
 
 struct _shm_rb {
   rb_header* header;
+  shm_import* import;
   rb_chunk* first;
   rb_chunk chunk[0];
 };
@@ -88,6 +97,9 @@ double wtime(void)
 
 #define VERBOSE 0
 
+/* size of the chunk filled from a trace file */
+#define IMPORT_CHUNKSIZE (64*1024)
+
 /* statistics */
 static double attach_time;
 static unsigned chunks_consumed = 0;
@@ -124,6 +136,7 @@ shm_buf* attach(int pid)
 
     producer_pid = pid;
 
+    b->import = 0;
     b->h = (shm_header*) addr;
     shm_printf("Event consumer: attaching to '%s'.\n", b->file);
     if (b->h->producer_initialized == 0) {
@@ -148,9 +161,19 @@ shm_buf* shm_init(int argc, char* argv[])
   int pid = 0;
   shm_buf* b;
   int arg;
+  char* trace = 0;
+  int format = 0;
 
   for(arg=1; arg<argc; arg++) {
-    if (argv[arg][0] == '-') {
+    if (strncmp(argv[arg], "--trace=", 8) == 0)
+      trace = argv[arg] + 8;
+    else if (strcmp(argv[arg], "--trace-format=din") == 0)
+      format = IMPORT_DIN;
+    else if (strcmp(argv[arg], "--trace-format=bin") == 0)
+      format = IMPORT_BIN;
+    else if (strcmp(argv[arg], "--trace-format=csv") == 0)
+      format = IMPORT_CSV;
+    else if (argv[arg][0] == '-') {
       if (argv[arg][1] == 'v')
 	verbose++;
     }
@@ -158,8 +181,27 @@ shm_buf* shm_init(int argc, char* argv[])
       pid = atoi(argv[arg]);
   }
 
+  if (trace) {
+    if (!import_open) {
+      printf("%s: no trace file import (build with shmlib/shm_import.c)\n",
+	     argv[0]);
+      exit(1);
+    }
+    b = (shm_buf*) malloc(sizeof(shm_buf));
+    b->h = 0;
+    b->import = import_open(trace, format);
+    if (!b->import) {
+      printf("Cannot read trace '%s'\n", trace);
+      exit(1);
+    }
+    attach_time = wtime();
+    return b;
+  }
+
   if (pid==0) {
-    printf("Usage: %s [-v] <pid>\n", argv[0]);
+    printf("Usage: %s [-v] <pid>\n"
+	   "       %s [-v] --trace=<file> [--trace-format=din|bin|csv]\n",
+	   argv[0], argv[0]);
     exit(1);
   }
 
@@ -187,6 +229,23 @@ shm_rb* open_rb(shm_buf* b, char* name)
     char* seg;
 
     if (!b) return 0;
+    if (b->import) {
+      /* events from trace file are in ring 'tr_main', using one chunk */
+      if (strcmp(name, "tr_main") != 0) return 0;
+      rb = (shm_rb*) malloc(sizeof(shm_rb) + sizeof(rb_chunk));
+      if (!rb) return 0;
+      rb->header = 0;
+      rb->import = b->import;
+      rb->first = &(rb->chunk[0]);
+      rb->chunk[0].rb = rb;
+      rb->chunk[0].state = 0;
+      rb->chunk[0].buffer = (unsigned char*) malloc(IMPORT_CHUNKSIZE);
+      rb->chunk[0].used = -1;
+      rb->chunk[0].read = 0;
+      rb->chunk[0].next = &(rb->chunk[0]);
+      return rb;
+    }
+
     for(s=0;s<15;s++)
 	if ((b->h->seg[s].offset >0) &&
 	    (strcmp(name, b->h->seg[s].name)==0)) break;
@@ -199,6 +258,7 @@ shm_rb* open_rb(shm_buf* b, char* name)
     if (!rb) return 0;
 
     rb->header = h;
+    rb->import = 0;
     rb->first = &(rb->chunk[0]);
     for(i=0;i<h->chunk_count;i++) {
       rb->chunk[i].rb = rb;
@@ -220,6 +280,12 @@ static void open_chunk(rb_chunk** cPtr)
 {
     rb_chunk* c = *cPtr;
 
+    if (c->rb->import) {
+      c->used = import_fill(c->rb->import, c->buffer, IMPORT_CHUNKSIZE);
+      c->read = 0;
+      return;
+    }
+
     if (*(c->state) == RBSTATE_EMPTY) {
 	double t;
 
@@ -254,12 +320,8 @@ rb_chunk* open_first(shm_rb* rb)
     return c;
 }
 
-rb_chunk* finish_chunk(rb_chunk* c, rb_chunk** cPtr)
+static void print_stats(void)
 {
-  assert(c->read == c->used);
-  chunks_consumed++;
-  bytes_consumed += c->read;
-  if (*(c->state) == RBSTATE_FULLEND) {
     double t = wtime() - attach_time;
     double tt = t - wait_time;
     shm_printf("Event consumer: statistics\n");
@@ -272,6 +334,24 @@ rb_chunk* finish_chunk(rb_chunk* c, rb_chunk** cPtr)
 	   (double) bytes_consumed / t / 1000000.0,
 	   (double) events_consumed / tt / 1000000.0,
 	   (double) bytes_consumed / tt / 1000000.0 );
+}
+
+rb_chunk* finish_chunk(rb_chunk* c, rb_chunk** cPtr)
+{
+  assert(c->read == c->used);
+  chunks_consumed++;
+  bytes_consumed += c->read;
+  if (c->rb->import) {
+    /* refill the chunk from the trace file */
+    open_chunk(cPtr);
+    if (c->used > 0) return c;
+    print_stats();
+    import_close(c->rb->import);
+    c->rb->import = 0;
+    return 0;
+  }
+  if (*(c->state) == RBSTATE_FULLEND) {
+    print_stats();
     return 0;
   }
   *(c->state) = RBSTATE_EMPTY;
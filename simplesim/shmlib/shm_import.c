@@ -0,0 +1,309 @@
+/* Trace file import for the event bridge (consumer side)
+ * See shm_import.h
+ *
+ * (C) 2011, Josef Weidendorfer
+ */
+
+#include "shm_import.h"
+#include "shm_consumer.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// event definitions: same layout for McTracer producer
+typedef unsigned long long Addr;
+#include "../tr_shmevents.h"
+#include "../simlog.h"
+
+/* read-ahead window in front of the parse position */
+#define READAHEAD (4<<20)
+
+/* space needed for the events of one record (RUN_TID + RANGE) */
+#define MAX_RECORD_EVENTS 32
+
+struct _shm_import {
+    int format;
+    unsigned char *start, *pos, *end; // mapped trace file
+    unsigned char* advised;           // read-ahead requested up to here
+    int tid;                          // thread of last access
+    unsigned long long records, skipped;
+};
+
+shm_import* import_open(char* file, int format)
+{
+    shm_import* imp;
+    struct stat st;
+    void* addr;
+    int fd;
+    char* ext;
+
+    fd = open(file, O_RDONLY);
+    if (fd<0) return 0;
+    if ((fstat(fd, &st) < 0) || (st.st_size == 0)) {
+	close(fd);
+	return 0;
+    }
+    addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == (void*)-1) return 0;
+    madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+    imp = (shm_import*) malloc(sizeof(shm_import));
+    imp->start = imp->pos = addr;
+    imp->end = imp->start + st.st_size;
+    imp->advised = imp->start;
+    imp->tid = -1;
+    imp->records = imp->skipped = 0;
+
+    if (format == 0) {
+	ext = strrchr(file, '.');
+	if ((st.st_size >= (off_t) sizeof(simlog_header)) &&
+	    (memcmp(addr, SIMLOG_MAGIC, 8) == 0))
+	    format = IMPORT_BIN;
+	else if (ext && (strcmp(ext, ".csv") == 0))
+	    format = IMPORT_CSV;
+	else
+	    format = IMPORT_DIN;
+    }
+    imp->format = format;
+
+    if (format == IMPORT_BIN) {
+	simlog_header* h = (simlog_header*) imp->start;
+	if ((st.st_size < (off_t) sizeof(simlog_header)) ||
+	    (memcmp(h->magic, SIMLOG_MAGIC, 8) != 0) ||
+	    (h->record_size != sizeof(simlog_record))) {
+	    fprintf(stderr, "%s: not a binary trace of this version\n", file);
+	    import_close(imp);
+	    return 0;
+	}
+	imp->pos += sizeof(simlog_header);
+    }
+
+    shm_printf("Trace import: '%s' (%lld bytes, format %s)\n",
+	       file, (long long) st.st_size,
+	       (format == IMPORT_BIN) ? "bin" :
+	       (format == IMPORT_CSV) ? "csv" : "din");
+    return imp;
+}
+
+void import_close(shm_import* imp)
+{
+    shm_printf("Trace import: %llu accesses, %llu records skipped\n",
+	       imp->records, imp->skipped);
+    munmap(imp->start, imp->end - imp->start);
+    free(imp);
+}
+
+/*--------------------------------------------------------------
+ * Parsing helpers, never reading beyond <end>
+ */
+
+static inline int hexval(unsigned char c)
+{
+    if ((c >= '0') && (c <= '9')) return c - '0';
+    if ((c >= 'a') && (c <= 'f')) return c - 'a' + 10;
+    if ((c >= 'A') && (c <= 'F')) return c - 'A' + 10;
+    return -1;
+}
+
+static inline unsigned char* skip_blanks(unsigned char* p, unsigned char* end)
+{
+    while((p < end) && ((*p == ' ') || (*p == '\t'))) p++;
+    return p;
+}
+
+static inline unsigned char* next_line(unsigned char* p, unsigned char* end)
+{
+    unsigned char* nl = memchr(p, '\n', end - p);
+    return nl ? nl + 1 : end;
+}
+
+static inline unsigned char* parse_hex(unsigned char* p, unsigned char* end,
+				       Addr* v)
+{
+    Addr a = 0;
+    int d;
+
+    if ((p+1 < end) && (p[0] == '0') && ((p[1] == 'x') || (p[1] == 'X')))
+	p += 2;
+    while((p < end) && ((d = hexval(*p)) >= 0)) {
+	a = (a << 4) | d;
+	p++;
+    }
+    *v = a;
+    return p;
+}
+
+/* decimal, or hex with "0x" prefix */
+static inline unsigned char* parse_num(unsigned char* p, unsigned char* end,
+				       Addr* v)
+{
+    Addr a = 0;
+
+    if ((p+1 < end) && (p[0] == '0') && ((p[1] == 'x') || (p[1] == 'X')))
+	return parse_hex(p, end, v);
+    while((p < end) && (*p >= '0') && (*p <= '9')) {
+	a = a * 10 + (*p - '0');
+	p++;
+    }
+    *v = a;
+    return p;
+}
+
+/*--------------------------------------------------------------
+ * Record parsers: return 1 and set access if a record was parsed,
+ * 0 if the record is skipped. Advance imp->pos to next record.
+ */
+
+static int parse_din(shm_import* imp, Addr* addr, int* len, int* write)
+{
+    unsigned char *p = imp->pos, *end = imp->end;
+    int label;
+
+    p = skip_blanks(p, end);
+    if ((p == end) || (*p < '0') || (*p > '9')) {
+	imp->pos = next_line(p, end);
+	return 0;
+    }
+    label = *p++ - '0';
+    p = skip_blanks(p, end);
+    p = parse_hex(p, end, addr);
+    imp->pos = next_line(p, end);
+
+    // 2: instruction fetch, 3: escape, 4: cache flush
+    if (label > 1) return 0;
+    *write = label;
+    *len = IMPORT_DIN_SIZE;
+    return 1;
+}
+
+static int parse_csv(shm_import* imp, Addr* addr, int* len, int* write,
+		     int* tid)
+{
+    unsigned char *p = imp->pos, *end = imp->end;
+    Addr v;
+
+    p = skip_blanks(p, end);
+    if ((p == end) || (*p < '0') || (*p > '9')) {
+	imp->pos = next_line(p, end);
+	return 0;
+    }
+    p = parse_num(p, end, addr);
+    p = skip_blanks(p, end);
+    if ((p == end) || (*p != ',')) goto bad;
+    p = skip_blanks(p+1, end);
+    p = parse_num(p, end, &v);
+    *len = (int) v;
+    p = skip_blanks(p, end);
+    if ((p == end) || (*p != ',')) goto bad;
+    p = skip_blanks(p+1, end);
+    if (p == end) goto bad;
+    switch(*p) {
+    case 'R': case 'r': case 'L': case 'l': case '0': *write = 0; break;
+    case 'W': case 'w': case 'S': case 's': case '1': *write = 1; break;
+    default: goto bad;
+    }
+    while((p < end) && (*p != ',') && (*p != '\n')) p++;
+    if ((p < end) && (*p == ',')) {
+	p = skip_blanks(p+1, end);
+	p = parse_num(p, end, &v);
+	*tid = (int) v;
+    }
+    imp->pos = next_line(p, end);
+    return (*len > 0);
+
+ bad:
+    imp->pos = next_line(p, end);
+    return 0;
+}
+
+static int parse_bin(shm_import* imp, Addr* addr, int* len, int* write,
+		     int* tid)
+{
+    simlog_record* r = (simlog_record*) imp->pos;
+
+    if (imp->pos + sizeof(simlog_record) > imp->end) {
+	// truncated record at end
+	imp->pos = imp->end;
+	return 0;
+    }
+    imp->pos += sizeof(simlog_record);
+    *addr = r->addr;
+    *len = r->len;
+    *write = r->flags & SIMLOG_WRITE;
+    *tid = r->tid;
+    return (*len > 0);
+}
+
+/*--------------------------------------------------------------
+ * Event generation
+ */
+
+int import_fill(shm_import* imp, unsigned char* buf, int size)
+{
+    unsigned char* out = buf;
+    unsigned char* limit = buf + size - MAX_RECORD_EVENTS;
+    tr_event* e;
+    Addr addr;
+    int len, write, tid, ok;
+
+    while((out <= limit) && (imp->pos < imp->end)) {
+
+	// request read-ahead of the next part of the trace
+	if (imp->pos + READAHEAD/2 > imp->advised) {
+	    unsigned char* a = imp->advised;
+	    size_t pagemask = sysconf(_SC_PAGESIZE) - 1;
+
+	    if (a < imp->pos) a = imp->pos;
+	    a = (unsigned char*) ((size_t)a & ~pagemask);
+	    imp->advised = a + READAHEAD;
+	    if (imp->advised > imp->end) imp->advised = imp->end;
+	    madvise(a, imp->advised - a, MADV_WILLNEED);
+	}
+
+	tid = -1;
+	switch(imp->format) {
+	case IMPORT_BIN: ok = parse_bin(imp, &addr, &len, &write, &tid); break;
+	case IMPORT_CSV: ok = parse_csv(imp, &addr, &len, &write, &tid); break;
+	default:         ok = parse_din(imp, &addr, &len, &write); break;
+	}
+	if (!ok) {
+	    imp->skipped++;
+	    continue;
+	}
+	imp->records++;
+
+	if ((tid >= 0) && (tid != imp->tid)) {
+	    imp->tid = tid;
+	    e = (tr_event*) out;
+	    e->len = 2 + sizeof(ev_run_tid);
+	    e->tag = TR_RUN_TID;
+	    e->run_tid.tid = tid;
+	    out += e->len;
+	}
+
+	e = (tr_event*) out;
+	if (len <= TR_DATA_LEN_MAX) {
+	    // read and write events have same layout
+	    e->len = 2 + sizeof(ev_data_read);
+	    e->tag = write ? TR_DATA_WRITE : TR_DATA_READ;
+	    e->data_read.addr = addr;
+	    e->data_read.len = len;
+	}
+	else {
+	    e->len = 2 + sizeof(ev_data_range);
+	    e->tag = TR_DATA_RANGE;
+	    e->data_range.addr = addr;
+	    e->data_range.len = len;
+	    e->data_range.write = write;
+	}
+	out += e->len;
+    }
+    return out - buf;
+}
@@ -0,0 +1,41 @@
+/* Trace file import for the event bridge (consumer side)
+ *
+ * Instead of attaching to a running McTracer, a consumer can read
+ * memory accesses from a trace file ("--trace=<file>", see shm_init).
+ * The file is mapped into memory, and records are converted into
+ * TR_RUN_TID/TR_DATA_READ/TR_DATA_WRITE/TR_DATA_RANGE events which
+ * are delivered via the usual open_rb()/next_event() interface.
+ *
+ * Supported formats ("--trace-format=<fmt>", detected if not given):
+ *  din: Dinero IV "din" format, one "<label> <hexaddr>" per line.
+ *       Labels 0 (read) and 1 (write) are used, others are skipped.
+ *       din has no access sizes, all accesses are IMPORT_DIN_SIZE bytes.
+ *  bin: binary records as written by "simplesim --log=<file>" or
+ *       "tr-consumer --format=bin" (see ../simlog.h)
+ *  csv: "<addr>,<size>,<kind>[,<tid>]" per line, address decimal or
+ *       hex with "0x", kind R/L/0 for reads and W/S/1 for writes.
+ *       Lines not starting with a digit (headers, comments) are skipped.
+ *
+ * (C) 2011, Josef Weidendorfer
+ */
+
+#ifndef SHM_IMPORT_H
+#define SHM_IMPORT_H
+
+#define IMPORT_DIN   1
+#define IMPORT_BIN   2
+#define IMPORT_CSV   3
+
+#define IMPORT_DIN_SIZE 4
+
+typedef struct _shm_import shm_import;
+
+/* format 0: detect from file content/name. Returns 0 on error */
+shm_import* import_open(char* file, int format);
+
+/* fill <buf> with events, return bytes used, 0 at end of trace */
+int import_fill(shm_import*, unsigned char* buf, int size);
+
+void import_close(shm_import*);
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * Binary per-access log of SimpleSim: double buffering and writer
+ * thread. See simlog.h.
+ * For ETI @ TUM, (C) 2011 Josef Weidendorfer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "simlog.h"
+
+simlog_record* simlog_next = NULL;
+simlog_record* simlog_end = NULL;
+
+static FILE* log_file = NULL;
+static const char* log_name;
+static simlog_record* block[2];
+static int full[2];          // records in full block, 0 if free
+static int current = 0;      // block filled by the simulator
+static int done = 0;
+static unsigned long long records = 0, waits = 0;
+
+static pthread_t writer;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond_full = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t cond_free = PTHREAD_COND_INITIALIZER;
+
+static void* writer_main(void* arg)
+{
+	int w = 0;
+	size_t n;
+
+	(void)arg;
+
+	pthread_mutex_lock(&lock);
+	while(1) {
+		while(!full[w] && !done)
+			pthread_cond_wait(&cond_full, &lock);
+		if (!full[w])
+			break;
+		n = full[w];
+		pthread_mutex_unlock(&lock);
+
+		if (fwrite(block[w], sizeof(simlog_record), n, log_file) != n)
+			perror("simplesim: writing access log");
+
+		pthread_mutex_lock(&lock);
+		full[w] = 0;
+		pthread_cond_signal(&cond_free);
+		w ^= 1;
+	}
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+int simlog_open(const char* file)
+{
+	simlog_header h;
+
+	log_file = fopen(file, "w");
+	if (!log_file) return 0;
+	log_name = file;
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SIMLOG_MAGIC, 8);
+	h.record_size = sizeof(simlog_record);
+	h.flags = SIMLOG_HAS_HIT;
+	fwrite(&h, sizeof(h), 1, log_file);
+
+	block[0] = malloc(2 * SIMLOG_BLOCK * sizeof(simlog_record));
+	block[1] = block[0] + SIMLOG_BLOCK;
+	simlog_next = block[0];
+	simlog_end = block[0] + SIMLOG_BLOCK;
+
+	pthread_create(&writer, 0, writer_main, 0);
+	return 1;
+}
+
+// hand current block to the writer, continue with the other one
+void simlog_submit()
+{
+	int n = simlog_next - block[current];
+
+	if (n == 0) return;
+	records += n;
+
+	pthread_mutex_lock(&lock);
+	full[current] = n;
+	pthread_cond_signal(&cond_full);
+	current ^= 1;
+	if (full[current]) {
+		// writer is behind
+		waits++;
+		while(full[current])
+			pthread_cond_wait(&cond_free, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+
+	simlog_next = block[current];
+	simlog_end = block[current] + SIMLOG_BLOCK;
+}
+
+void simlog_close()
+{
+	if (!log_file) return;
+
+	simlog_submit();
+	pthread_mutex_lock(&lock);
+	done = 1;
+	pthread_cond_signal(&cond_full);
+	pthread_mutex_unlock(&lock);
+	pthread_join(writer, 0);
+
+	fclose(log_file);
+	log_file = NULL;
+	free(block[0]);
+
+	printf("Access log: %llu records written to '%s' (simulator waited %llu times)\n",
+	       records, log_name, waits);
+}
@@ -0,0 +1,63 @@
+/*
+ * Binary per-access log of SimpleSim.
+ * For ETI @ TUM, (C) 2011 Josef Weidendorfer
+ *
+ * Instead of formatting a text line per access, records are filled
+ * into one of two blocks, and a writer thread writes full blocks to
+ * the log file while the simulator continues in the other block.
+ * Use "simlog2txt <file>" to get the log as text.
+ */
+
+#ifndef SIMLOG_H
+#define SIMLOG_H
+
+#define SIMLOG_MAGIC   "SSIMLOG1"
+
+/* file starts with this header, followed by records */
+typedef struct {
+	char magic[8];
+	unsigned int record_size;   // sizeof(simlog_record)
+	unsigned int flags;         // SIMLOG_HAS_HIT if hit flags are valid
+} simlog_header;
+
+#define SIMLOG_HAS_HIT 1
+
+/* flags of a record */
+#define SIMLOG_WRITE  1
+#define SIMLOG_HIT    2
+
+typedef struct {
+	unsigned long long addr;
+	unsigned int len;
+	unsigned short tid;
+	unsigned char flags;
+	unsigned char reserved;
+} simlog_record;
+
+/* records per block */
+#define SIMLOG_BLOCK  65536
+
+/* return 0 if log file could not be created */
+int simlog_open(const char* file);
+void simlog_close();
+
+extern simlog_record* simlog_next;   // next free record
+extern simlog_record* simlog_end;    // end of current block
+void simlog_submit();
+
+// append record for one access
+static inline void simlog_add(unsigned long long addr, unsigned int len, int tid,
+			      int write, int hit)
+{
+	simlog_record* r = simlog_next++;
+
+	r->addr = addr;
+	r->len = len;
+	r->tid = tid;
+	r->flags = (write ? SIMLOG_WRITE : 0) | (hit ? SIMLOG_HIT : 0);
+	r->reserved = 0;
+	if (simlog_next == simlog_end)
+		simlog_submit();
+}
+
+#endif
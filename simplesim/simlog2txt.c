@@ -0,0 +1,56 @@
+/*
+ * Convert a binary access log of SimpleSim (see simlog.h) to text,
+ * one line per access.
+ * For ETI @ TUM, (C) 2011 Josef Weidendorfer
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "simlog.h"
+
+#define RECORDS 4096
+
+int main(int argc, char* argv[])
+{
+	FILE* f;
+	simlog_header h;
+	simlog_record rec[RECORDS];
+	static char outbuf[1<<20];
+	size_t n, i;
+	int has_hit;
+
+	if (argc != 2) {
+		printf("Usage: %s <access log of simplesim>\n", argv[0]);
+		exit(1);
+	}
+	f = fopen(argv[1], "r");
+	if (!f) {
+		perror(argv[1]);
+		exit(1);
+	}
+	if ((fread(&h, sizeof(h), 1, f) != 1) ||
+	    (memcmp(h.magic, SIMLOG_MAGIC, 8) != 0) ||
+	    (h.record_size != sizeof(simlog_record))) {
+		printf("%s: not an access log of this simplesim version\n", argv[1]);
+		exit(1);
+	}
+
+	// traces written by tr-consumer are not simulated
+	has_hit = h.flags & SIMLOG_HAS_HIT;
+
+	setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+	while( (n = fread(rec, sizeof(simlog_record), RECORDS, f)) > 0 ) {
+		for(i=0; i<n; i++) {
+			printf(" > %s by T%d at %p, size %2u",
+			       (rec[i].flags & SIMLOG_WRITE) ? "Store" : "Load ",
+			       rec[i].tid, (void*) rec[i].addr, rec[i].len);
+			if (has_hit)
+				printf(": %s", (rec[i].flags & SIMLOG_HIT) ? "Hit ":"Miss");
+			printf("\n");
+		}
+	}
+	fclose(f);
+	return 0;
+}
@@ -6,8 +6,10 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "shmlib/shm_consumer.h"
+#include "simlog.h"
 
 // 64-bit type for addresses: this needs mctracer to be 64bit binary !!
 typedef unsigned long long Addr;
@@ -82,7 +84,7 @@ int cache_ref(Addr a, int size)
 	int  set1 = ( a         / LINESIZE) & (SETS-1);
 	int  set2 = ((a+size-1) / LINESIZE) & (SETS-1);
 	Addr tag  = a / LINESIZE / SETS;
-	Addr tag2;
+	Addr tag2, lines;
 	int res1, res2;
 
 	/* Access entirely within line. */
@@ -90,14 +92,28 @@ int cache_ref(Addr a, int size)
 		return cache_setref(set1, tag);
 
 	/* Access straddles two lines. */
-	/* NOTE: We assume an access not overlapping >2 cache lines ! */
-	tag2  = (a+size-1) / LINESIZE / SETS;
-
-	/* the call updates cache structures as side effect */
-	res1 =  cache_setref(set1, tag);
-	res2 =  cache_setref(set2, tag2);
-	/* return 0 (=Miss) if at least one result was 0 */
-	return res1 * res2;
+	if (size <= LINESIZE) {
+		tag2  = (a+size-1) / LINESIZE / SETS;
+
+		/* the call updates cache structures as side effect */
+		res1 =  cache_setref(set1, tag);
+		res2 =  cache_setref(set2, tag2);
+		/* return 0 (=Miss) if at least one result was 0 */
+		return res1 * res2;
+	}
+
+	/* Large access (TR_DATA_RANGE): walk all lines in sequence.
+	 * Consecutive lines are in consecutive sets. */
+	lines = (a+size-1) / LINESIZE - a / LINESIZE + 1;
+	res1 = 1;
+	while(lines--) {
+		res1 &= cache_setref(set1, tag);
+		if (++set1 == SETS) {
+			set1 = 0;
+			tag++;
+		}
+	}
+	return res1;
 }
 
 
@@ -110,6 +126,9 @@ int loads = 0, stores = 0, lmisses = 0, smisses = 0;
 int tid = 0;
 
 
+// per-access log, off by default (see simlog.h)
+int log_accesses = 0;
+
 void run_tid(ev_run_tid* e)
 {  
 	// not really needed here: we assume a shared cache for all threads
@@ -120,8 +139,8 @@ void data_read(ev_data_read* e)
 {
 	int res;
 	res = cache_ref(e->addr, e->len);
-	printf(" > Load  by T%d at %p, size %2d: %s\n",
-		 tid, (void*) e->addr, e->len, res ? "Hit ":"Miss");
+	if (log_accesses)
+		simlog_add(e->addr, e->len, tid, 0, res);
 	loads++;
 	if (res == 0) lmisses++;
 }
@@ -130,18 +149,48 @@ void data_write(ev_data_write* e)
 {
 	int res;
 	res = cache_ref(e->addr, e->len);
-	printf(" > Store by T%d at %p, size %2d: %s\n",
-		 tid, (void*) e->addr, e->len, res ? "Hit ":"Miss");
+	if (log_accesses)
+		simlog_add(e->addr, e->len, tid, 1, res);
 	stores++;
 	if (res == 0) smisses++;
 }
 
+void data_range(ev_data_range* e)
+{
+	int res;
+	res = cache_ref(e->addr, e->len);
+	if (log_accesses)
+		simlog_add(e->addr, e->len, tid, e->write, res);
+	if (e->write) {
+		stores++;
+		if (res == 0) smisses++;
+	}
+	else {
+		loads++;
+		if (res == 0) lmisses++;
+	}
+}
+
 int main(int argc, char* argv[])
 {
 	shm_buf* buf;
 	shm_rb* rb;
 	rb_chunk* chunk;
 	tr_event* e;
+	char* log = getenv("SIMPLESIM_LOG");
+	int i;
+
+	/* "--log=<file>" writes a binary log of all accesses */
+	for(i=1; i<argc; i++)
+		if (strncmp(argv[i], "--log=", 6) == 0)
+			log = argv[i] + 6;
+	if (log && *log) {
+		if (!simlog_open(log)) {
+			printf("Cannot open access log '%s'\n", log);
+			exit(1);
+		}
+		log_accesses = 1;
+	}
 
 	/* initialize event passing via shared memory */
 	buf = shm_init(argc, argv);
@@ -165,6 +214,9 @@ int main(int argc, char* argv[])
 			case TR_DATA_WRITE:
 				data_write(&(e->data_write));
 				break;
+			case TR_DATA_RANGE:
+				data_range(&(e->data_range));
+				break;
 			default:
 				printf(" Unknown event tag %d\n", e->tag);
 				abort();
@@ -172,6 +224,8 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	simlog_close();
+
 	printf("\nSummary:\n");
 	printf("Cache holding %d bytes (%d lines, ass. %d, sets: %d).\n",
 			LINESIZE * CACHELINES, CACHELINES, SETSIZE, SETS);
@@ -11,6 +11,11 @@
 #define TR_RUN_TID           1
 #define TR_DATA_READ         2
 #define TR_DATA_WRITE        3
+#define TR_DATA_RANGE       15
+
+/* larger accesses do not fit into <len> of TR_DATA_READ/TR_DATA_WRITE,
+ * and are sent as TR_DATA_RANGE */
+#define TR_DATA_LEN_MAX     127
 
 typedef struct _tr_event tr_event;
 
@@ -34,6 +39,15 @@ typedef struct {
   char len;
 } ev_data_write;
 
+// tag TR_DATA_RANGE
+// Access to <len> bytes from <addr>, too large for <len> of
+// TR_DATA_READ/TR_DATA_WRITE. A write if <write> is 1.
+typedef struct {
+  Addr addr;
+  unsigned int len;
+  unsigned char write;
+} ev_data_range;
+
 struct _tr_event {
   /* Event header */
   unsigned char len;
@@ -42,6 +56,7 @@ struct _tr_event {
     ev_run_tid     run_tid;
     ev_data_read   data_read;
     ev_data_write  data_write;
+    ev_data_range  data_range;
   };
 };
 #pragma pack(pop)